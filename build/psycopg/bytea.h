@@ -0,0 +1,271 @@
+/*
+ * Copyright (C) 2001 Federico Di Gregorio <fog@debian.org>
+ *
+ * This file is part of the psycopg module.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * bytea.h -- bytea escaping and decoding kernels
+ *
+ * the kernels work on plain buffers, without python objects, so that
+ * typemod.c (escaping), typeobj.c (decoding) and tests/bench_bytea.c share
+ * the same code. define PSYCO_BYTEA_ENCODE and/or PSYCO_BYTEA_DECODE before
+ * including this file to get the escaping and/or the decoding kernels.
+ */
+
+#ifndef __PSYCOPG_BYTEA__
+#define __PSYCOPG_BYTEA__
+
+#include <stddef.h>
+#include <string.h>
+
+
+/**** tests on all the bytes of an unsigned long at once, used to skip over
+      bytes that don't need escaping ****/
+#define WORD_ONES          (~0UL / 255)
+#define WORD_HIGHBITS      (WORD_ONES * 0x80)
+#define WORD_HASZERO(v)    (((v) - WORD_ONES) & ~(v) & WORD_HIGHBITS)
+#define WORD_HASVALUE(v, n) WORD_HASZERO((v) ^ (WORD_ONES * (n)))
+#define WORD_HASLESS(v, n) (((v) - WORD_ONES * (n)) & ~(v) & WORD_HIGHBITS)
+#define WORD_HASMORE(v, n) ((((v) + WORD_ONES * (127 - (n))) | (v)) \
+                            & WORD_HIGHBITS)
+
+
+#ifdef PSYCO_BYTEA_ENCODE
+
+/* escaping kernels
+ *
+ * the escape format is checked a machine word at a time: words without
+ * bytes to escape (control characters, bytes >= 0x7f, quotes and
+ * backslashes) are copied as a whole, the others are escaped using a table
+ * with the escaped form of every byte. the size of the result is computed
+ * first (_psyco_bytea_escapelen()), so that the escaped bytes can be written
+ * directly into the final buffer.
+ */
+
+#define NEEDESCAPE(v)  (WORD_HASLESS(v, 0x20) | WORD_HASMORE(v, 0x7e) \
+                        | WORD_HASVALUE(v, '\'') | WORD_HASVALUE(v, '\\'))
+
+/* escaped form of every byte: \\nnn, \\\\, \' or the byte itself; bytes are
+   always copied 5 at a time, so the result needs ESCAPESLACK spare bytes */
+#define ESCAPESLACK 4
+
+static struct {
+    unsigned char len;
+    unsigned char str[5];
+} psyco_bytea_escapes[256];
+
+static const char psyco_hexdigits[] = "0123456789abcdef";
+
+/* _psyco_bytea_init() - fill the escapes table, call it before escaping */
+static void
+_psyco_bytea_init(void)
+{
+    int c;
+
+    for (c = 0; c < 256; c++) {
+        unsigned char *s = psyco_bytea_escapes[c].str;
+
+        if (c < 0x20 || c > 0x7e) {
+            s[0] = s[1] = '\\';
+            s[2] = ((c >> 6) & 0x07) + '0';
+            s[3] = ((c >> 3) & 0x07) + '0';
+            s[4] = (c & 0x07) + '0';
+            psyco_bytea_escapes[c].len = 5;
+        }
+        else if (c == '\'') {
+            s[0] = '\\'; s[1] = '\'';
+            psyco_bytea_escapes[c].len = 2;
+        }
+        else if (c == '\\') {
+            s[0] = s[1] = s[2] = s[3] = '\\';
+            psyco_bytea_escapes[c].len = 4;
+        }
+        else {
+            s[0] = c;
+            psyco_bytea_escapes[c].len = 1;
+        }
+    }
+}
+
+static size_t
+_psyco_bytea_escapelen(const unsigned char *src, size_t len)
+{
+    size_t i = 0, size = 0, j;
+    unsigned long v;
+
+    for (; i + sizeof(v) <= len; i += sizeof(v)) {
+        memcpy(&v, src + i, sizeof(v));
+        if (!NEEDESCAPE(v)) {
+            size += sizeof(v);
+            continue;
+        }
+        for (j = 0; j < sizeof(v); j++)
+            size += psyco_bytea_escapes[src[i+j]].len;
+    }
+    for (; i < len; i++) size += psyco_bytea_escapes[src[i]].len;
+    return size;
+}
+
+/* _psyco_bytea_escape() - write the escape format, return the end of dst */
+static unsigned char *
+_psyco_bytea_escape(unsigned char *dst, const unsigned char *src, size_t len)
+{
+    size_t i = 0, j;
+    unsigned long v;
+
+    for (; i + sizeof(v) <= len; i += sizeof(v)) {
+        memcpy(&v, src + i, sizeof(v));
+        if (!NEEDESCAPE(v)) {
+            memcpy(dst, &v, sizeof(v));
+            dst += sizeof(v);
+            continue;
+        }
+        for (j = 0; j < sizeof(v); j++) {
+            memcpy(dst, psyco_bytea_escapes[src[i+j]].str, 5);
+            dst += psyco_bytea_escapes[src[i+j]].len;
+        }
+    }
+    for (; i < len; i++) {
+        memcpy(dst, psyco_bytea_escapes[src[i]].str, 5);
+        dst += psyco_bytea_escapes[src[i]].len;
+    }
+    return dst;
+}
+
+/* _psyco_bytea_hex() - write the hex digits, return the end of dst */
+static unsigned char *
+_psyco_bytea_hex(unsigned char *dst, const unsigned char *src, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        dst[2*i] = psyco_hexdigits[src[i] >> 4];
+        dst[2*i+1] = psyco_hexdigits[src[i] & 0x0f];
+    }
+    return dst + 2*len;
+}
+
+#endif /* PSYCO_BYTEA_ENCODE */
+
+
+#ifdef PSYCO_BYTEA_DECODE
+
+/* decoding kernels
+ *
+ * the hex format (default since PostgreSQL 9.0) is "\x" followed by two hex
+ * digits per byte; the escape format leaves printable bytes as they are and
+ * uses \\ and \nnn for the others. the escape format never expands the data:
+ * a buffer as long as the value is always enough.
+ */
+
+/* value of every hex digit, 0xff if not a hex digit */
+static const unsigned char psyco_hexvalue[256] = {
+#define N 0xff
+    N,N,N,N,N,N,N,N,N,N,N,N,N,N,N,N, N,N,N,N,N,N,N,N,N,N,N,N,N,N,N,N,
+    N,N,N,N,N,N,N,N,N,N,N,N,N,N,N,N, 0,1,2,3,4,5,6,7,8,9,N,N,N,N,N,N,
+    N,10,11,12,13,14,15,N,N,N,N,N,N,N,N,N, N,N,N,N,N,N,N,N,N,N,N,N,N,N,N,N,
+    N,10,11,12,13,14,15,N,N,N,N,N,N,N,N,N, N,N,N,N,N,N,N,N,N,N,N,N,N,N,N,N,
+    N,N,N,N,N,N,N,N,N,N,N,N,N,N,N,N, N,N,N,N,N,N,N,N,N,N,N,N,N,N,N,N,
+    N,N,N,N,N,N,N,N,N,N,N,N,N,N,N,N, N,N,N,N,N,N,N,N,N,N,N,N,N,N,N,N,
+    N,N,N,N,N,N,N,N,N,N,N,N,N,N,N,N, N,N,N,N,N,N,N,N,N,N,N,N,N,N,N,N,
+    N,N,N,N,N,N,N,N,N,N,N,N,N,N,N,N, N,N,N,N,N,N,N,N,N,N,N,N,N,N,N,N
+#undef N
+};
+
+/* _psyco_bytea_unhex() - decode n bytes from the 2*n hex digits of src
+ *
+ * there are no branches in the loop: invalid digits are collected and the
+ * function returns true if src had any.
+ */
+static int
+_psyco_bytea_unhex(unsigned char *dst, const unsigned char *src, size_t n)
+{
+    unsigned char hi, lo, bad = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        hi = psyco_hexvalue[src[2*i]];
+        lo = psyco_hexvalue[src[2*i+1]];
+        bad |= hi | lo;
+        dst[i] = (unsigned char)((hi << 4) | lo);
+    }
+    return (bad & 0xf0) != 0;
+}
+
+/* _psyco_bytea_unescape() - decode the escape format, return the end of dst
+ *
+ * words without backslashes are copied as a whole instead of byte by byte.
+ */
+static unsigned char *
+_psyco_bytea_unescape(unsigned char *dst, const char *s, size_t len)
+{
+    const char *end = s + len, *wend;
+    unsigned char c;
+    unsigned long v;
+
+    while (end - s >= (ptrdiff_t)(sizeof(v) + 3)) {
+        /* copy whole words without backslashes */
+        memcpy(&v, s, sizeof(v));
+        if (!WORD_HASVALUE(v, '\\')) {
+            memcpy(dst, &v, sizeof(v));
+            dst += sizeof(v);
+            s += sizeof(v);
+            continue;
+        }
+
+        /* decode the others byte by byte (an escape sequence can end in the
+           next word, there are always 3 more bytes to read) */
+        for (wend = s + sizeof(v); s < wend; ) {
+            if ((c = s[0]) != '\\') {
+                *dst++ = c;
+                s++;
+            }
+            else if ((c = s[1]) == '\\') {
+                *dst++ = '\\';
+                s += 2;
+            }
+            else {
+                *dst++ = ((c & 7) << 6) | ((s[2] & 7) << 3) | (s[3] & 7);
+                s += 4;
+            }
+        }
+    }
+
+    /* the last bytes, checking for the end of the string */
+    while (s < end) {
+        if (*s != '\\') {
+            *dst++ = *s++;
+        }
+        else if (s + 1 < end && s[1] == '\\') {
+            *dst++ = '\\';
+            s += 2;
+        }
+        else if (s + 3 < end) {
+            *dst++ = ((s[1] & 7) << 6) | ((s[2] & 7) << 3) | (s[3] & 7);
+            s += 4;
+        }
+        else {
+            *dst++ = *s++;
+        }
+    }
+    return dst;
+}
+
+#endif /* PSYCO_BYTEA_DECODE */
+
+#endif /* __PSYCOPG_BYTEA__ */
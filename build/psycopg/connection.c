@@ -26,6 +26,9 @@
 
 #include "module.h"
 #include <assert.h>
+#ifndef _WIN32
+#include <sys/time.h>
+#endif
 
 /**** UTILITY FUNCTIONS ****/
 
@@ -68,10 +71,13 @@ _curs_doall(connobject *self, int (*operation)(cursobject *) )
 {
     int len, i, has_errors = 0;
     cursobject *cursor;
+    double start = 0.0, locked = 0.0;
+    int instrument = self->instrument;
 
     doall_state_t *cursors = NULL;
     PyObject* errs = NULL;
 
+    if (instrument) start = psyco_gettime();
     Dprintf("curs_doall: acquiring lock\n");
     pthread_mutex_lock(&(self->lock));
     Dprintf("curs_doall: lock acquired\n");
@@ -114,6 +120,7 @@ _curs_doall(connobject *self, int (*operation)(cursobject *) )
             }
         }
     }
+    if (instrument) locked = psyco_gettime();
 
     /* does all the operations */
     for (i = 0; i < len; i++) {
@@ -150,6 +157,8 @@ _curs_doall(connobject *self, int (*operation)(cursobject *) )
     Dprintf("curs_doall: lock released\n");
     Py_END_ALLOW_THREADS;
 
+    if (instrument) self->stats.lockwait += locked - start;
+
     /* if an error occurred, set up the error dictionary (or set errs to
      * None if we can't create the dictionary). */
     if (has_errors) {
@@ -209,6 +218,306 @@ curs_commitall(connobject *self)
 }
 
 
+/**** INSTRUMENTATION ****/
+
+/* psyco_gettime() - the current time in seconds, used to time queries
+ *
+ * only the difference between two calls is meaningful.
+ */
+double
+psyco_gettime(void)
+{
+#ifndef _WIN32
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (double)tv.tv_sec + (double)tv.tv_usec * 1e-6;
+#else
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER count;
+
+    if (freq.QuadPart == 0) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (double)count.QuadPart / (double)freq.QuadPart;
+#endif
+}
+
+
+/**** CONNECTION POOL ****/
+
+/* _pool_trim() - unlink idle keepers exceeding minconn for too long
+ *
+ * returns the unlinked keepers chained on their next field; they should be
+ * freed with _pool_free() after releasing the pool lock.
+ *
+ * this function should be called with a lock on the pool
+ */
+static connkeeper *
+_pool_trim(connobject *conn, time_t now)
+{
+    connkeeper **k = &(conn->avail), *closing = NULL, *keeper;
+
+    while ((keeper = *k) != NULL && conn->nopen > conn->minconn) {
+        if (now - keeper->idle >= conn->idletime) {
+            Dprintf("_pool_trim: keeper at %p idle for %ld seconds\n",
+                    keeper, (long)(now - keeper->idle));
+            *k = keeper->next;
+            keeper->next = closing;
+            closing = keeper;
+            conn->navail--;
+            conn->nopen--;
+            conn->destroys++;
+        }
+        else {
+            k = &(keeper->next);
+        }
+    }
+    return closing;
+}
+
+/* _pool_free() - free a chain of keepers returned by _pool_trim()
+ *
+ * this function does not call Py_*_ALLOW_THREADS macros
+ */
+static void
+_pool_free(connkeeper *closing)
+{
+    connkeeper *keeper;
+
+    while ((keeper = closing) != NULL) {
+        closing = keeper->next;
+        free_keeper(keeper);
+    }
+}
+
+/* _pool_check() - make sure an idle keeper is still usable
+ *
+ * connections idle for more than POOLCHECK seconds are pinged with an empty
+ * query, the others are only checked for their status.
+ *
+ * this function does not call Py_*_ALLOW_THREADS macros
+ */
+static int
+_pool_check(connkeeper *keeper, time_t now)
+{
+    PGresult *pgres;
+    int ok;
+
+    if (PQstatus(keeper->pgconn) != CONNECTION_OK) return 0;
+#if POSTGRESQL_MAJOR >= 8
+    if (PQtransactionStatus(keeper->pgconn) != PQTRANS_IDLE) return 0;
+#endif
+    if (now - keeper->idle < POOLCHECK) return 1;
+
+    Dprintf("_pool_check: pinging keeper at %p\n", keeper);
+    pgres = PQexec(keeper->pgconn, "");
+    ok = pgres != NULL && PQresultStatus(pgres) == PGRES_EMPTY_QUERY;
+    IFCLEARPGRES(pgres);
+    return ok;
+}
+
+/* pool_get() - get a keeper from the pool, opening a new one if needed
+ *
+ * if the pool is empty and maxconn connections are open waits up to
+ * conn->timeout seconds for another cursor to release one. returns NULL
+ * and sets an exception on error.
+ *
+ * this function locks the pool
+ * this function enters an ALLOW_THREADS wrapper
+ */
+connkeeper *
+pool_get(connobject *conn)
+{
+    connkeeper *keeper = NULL, *closing;
+    struct timespec deadline;
+    time_t now;
+    int rv = 0, waited = 0, create = 0, nopen;
+    double start = 0.0, elapsed;
+
+    if (conn->instrument) start = psyco_gettime();
+
+    Py_BEGIN_ALLOW_THREADS;
+    pthread_mutex_lock(&(conn->poollock));
+    now = time(NULL);
+    deadline.tv_sec = now + conn->timeout;
+    deadline.tv_nsec = 0;
+
+    closing = _pool_trim(conn, now);
+
+    while (keeper == NULL) {
+        if ((keeper = conn->avail) != NULL) {
+            conn->avail = keeper->next;
+            conn->navail--;
+            keeper->next = NULL;
+
+            /* don't hold the pool while talking to the backend */
+            pthread_mutex_unlock(&(conn->poollock));
+            if (!_pool_check(keeper, time(NULL))) {
+                Dprintf("pool_get: keeper at %p is broken\n", keeper);
+                free_keeper(keeper);
+                keeper = NULL;
+            }
+            pthread_mutex_lock(&(conn->poollock));
+            if (keeper == NULL) {
+                conn->nopen--;
+                conn->destroys++;
+            }
+        }
+        else if (conn->nopen < conn->maxconn) {
+            /* reserve a slot, the connection is opened below */
+            conn->nopen++;
+            create = 1;
+            break;
+        }
+        else if (conn->timeout <= 0 || rv == ETIMEDOUT) {
+            break;
+        }
+        else {
+            if (!waited) conn->waits++;
+            waited = 1;
+            Dprintf("pool_get: waiting for a free connection\n");
+            rv = pthread_cond_timedwait(&(conn->poolcond), &(conn->poollock),
+                                        &deadline);
+        }
+    }
+    nopen = conn->nopen;
+    pthread_mutex_unlock(&(conn->poollock));
+    _pool_free(closing);
+    Py_END_ALLOW_THREADS;
+
+    if (create) {
+        keeper = alloc_keeper(conn);
+
+        pthread_mutex_lock(&(conn->poollock));
+        if (keeper) {
+            conn->creates++;
+        }
+        else {
+            conn->nopen--;
+            pthread_cond_signal(&(conn->poolcond));
+        }
+        pthread_mutex_unlock(&(conn->poollock));
+    }
+    else if (keeper == NULL) {
+        PyErr_Format(OperationalError,
+                     "too many open connections: %i\n"
+                     "Try increasing maximum number of physical "
+                     "connections when calling connect()", nopen);
+    }
+
+    if (conn->instrument && keeper) {
+        elapsed = psyco_gettime() - start;
+        conn->acquires++;
+        conn->acquiretime += elapsed;
+        if (elapsed > conn->acquiremax) conn->acquiremax = elapsed;
+    }
+
+    Dprintf("pool_get: got keeper at %p (created = %d)\n", keeper, create);
+    return keeper;
+}
+
+/* pool_put() - give back an idle keeper to the pool
+ *
+ * this function locks the pool
+ * this function enters an ALLOW_THREADS wrapper
+ */
+void
+pool_put(connobject *conn, connkeeper *keeper)
+{
+    connkeeper *closing;
+    time_t now = time(NULL);
+
+    keeper->idle = now;
+
+    pthread_mutex_lock(&(conn->poollock));
+    keeper->next = conn->avail;
+    conn->avail = keeper;
+    conn->navail++;
+    closing = _pool_trim(conn, now);
+    pthread_cond_signal(&(conn->poolcond));
+    pthread_mutex_unlock(&(conn->poollock));
+
+    if (closing) {
+        Py_BEGIN_ALLOW_THREADS;
+        _pool_free(closing);
+        Py_END_ALLOW_THREADS;
+    }
+}
+
+/* pool_discard() - close a keeper taken from the pool
+ *
+ * this function locks the pool
+ * this function enters an ALLOW_THREADS wrapper
+ */
+void
+pool_discard(connobject *conn, connkeeper *keeper)
+{
+    pthread_mutex_lock(&(conn->poollock));
+    conn->nopen--;
+    conn->destroys++;
+    pthread_cond_signal(&(conn->poolcond));
+    pthread_mutex_unlock(&(conn->poollock));
+
+    Py_BEGIN_ALLOW_THREADS;
+    free_keeper(keeper);
+    Py_END_ALLOW_THREADS;
+}
+
+/* _pool_warmup() - open connections until minconn are available
+ *
+ * returns -1 and sets an exception if a connection can't be opened.
+ */
+static int
+_pool_warmup(connobject *conn)
+{
+    connkeeper *keeper;
+
+    while (1) {
+        pthread_mutex_lock(&(conn->poollock));
+        if (conn->nopen >= conn->minconn) {
+            pthread_mutex_unlock(&(conn->poollock));
+            return 0;
+        }
+        conn->nopen++;
+        pthread_mutex_unlock(&(conn->poollock));
+
+        if (!(keeper = alloc_keeper(conn))) {
+            pthread_mutex_lock(&(conn->poollock));
+            conn->nopen--;
+            pthread_mutex_unlock(&(conn->poollock));
+            return -1;
+        }
+        pthread_mutex_lock(&(conn->poollock));
+        conn->creates++;
+        pthread_mutex_unlock(&(conn->poollock));
+        pool_put(conn, keeper);
+    }
+}
+
+/* _pool_close() - close all the idle connections
+ *
+ * this function enters an ALLOW_THREADS wrapper
+ */
+static void
+_pool_close(connobject *conn)
+{
+    connkeeper *closing;
+
+    pthread_mutex_lock(&(conn->poollock));
+    closing = conn->avail;
+    conn->nopen -= conn->navail;
+    conn->destroys += conn->navail;
+    conn->avail = NULL;
+    conn->navail = 0;
+    pthread_mutex_unlock(&(conn->poollock));
+
+    Dprintf("_pool_close: closing idle connections\n");
+    Py_BEGIN_ALLOW_THREADS;
+    _pool_free(closing);
+    Py_END_ALLOW_THREADS;
+}
+
+
 /**** CONNECTION METHODS *****/
 
 /* psyco_conn_close() - close the connection */
@@ -220,7 +529,6 @@ _psyco_conn_close(connobject *self)
 {
     int len, i;
     PyObject *tmpobj = NULL;
-    connkeeper *keeper;
     
     Dprintf("_psyco_conn_close(): closing all cursors\n");
     curs_closeall(self);
@@ -246,27 +554,10 @@ _psyco_conn_close(connobject *self)
     }
 
     /* close all the open postgresql connections */
-    len = PyList_Size(self->avail_conn);
-    Dprintf("_psyco_conn_close(): len(self->avail_conn) = %d\n", len);
-    for (i = len-1; i >= 0; i--) {
-        tmpobj = PyList_GetItem(self->avail_conn, i);
-        assert(tmpobj);
-        Py_INCREF(tmpobj);
-        if ((keeper = (connkeeper *)PyCObject_AsVoidPtr(tmpobj))) {
-            Dprintf("_psyco_conn_close(): destroying avail_conn[%i] at %p\n",
-                    i, keeper);
-            PQfinish(keeper->pgconn);
-            pthread_mutex_destroy(&(keeper->lock));
-            free(keeper);
-        }
-        PySequence_DelItem(self->avail_conn, i);
-        Py_DECREF(tmpobj);
-    }
+    _pool_close(self);
     
     Py_DECREF(self->cursors);
-    Py_DECREF(self->avail_conn);
     self->cursors = NULL;
-    self->avail_conn = NULL;
 
     /* orphan default cursor and destroy it (closing the last connection to the
        database) */
@@ -385,7 +676,12 @@ psyco_conn_rollback(connobject *self,	PyObject *args)
 /* psyco_conn_cursor() - create a new cursor */
 
 static char psyco_conn_cursor__doc__[] = 
-"Return a new Cursor Object using the connection.";
+"Return a new Cursor Object using the connection.\n"
+"If a name is given the cursor is a server-side cursor: results of\n"
+"execute() are not materialized on the client but are fetched from the\n"
+"backend arraysize rows at a time. Statements the backend can't read\n"
+"through a cursor (INSERT, UPDATE, SELECT INTO, FOR UPDATE...) are\n"
+"executed as on a normal cursor.";
 
 static PyObject *
 psyco_conn_cursor(connobject *self, PyObject *args)
@@ -417,7 +713,7 @@ psyco_conn_cursor(connobject *self, PyObject *args)
         pthread_mutex_unlock(&(keeper->lock));
     }
     
-    obj = (PyObject *)new_psyco_cursobject(self, keeper);
+    obj = (PyObject *)new_psyco_cursobject(self, keeper, name);
     return obj; 
 }
 
@@ -522,6 +818,128 @@ psyco_conn_serialize(connobject *self, PyObject *args)
 }
 
 
+/* psyco_conn_pool() - statistics about the pool of physical connections */
+
+static char psyco_conn_pool__doc__[] =
+"Returns a dictionary with the number of open and idle physical\n"
+"connections and how many times the pool had to wait for a free\n"
+"connection, create a new one or destroy one.";
+
+static PyObject *
+psyco_conn_pool(connobject *self, PyObject *args)
+{
+    PyObject *res;
+
+    EXC_IFCLOSED(self);
+    PARSEARGS(args);
+
+    pthread_mutex_lock(&(self->poollock));
+    res = Py_BuildValue("{s:i,s:i,s:i,s:i,s:l,s:l,s:l}",
+                        "size", self->nopen, "idle", self->navail,
+                        "minconn", self->minconn, "maxconn", self->maxconn,
+                        "waits", self->waits, "creates", self->creates,
+                        "destroys", self->destroys);
+    pthread_mutex_unlock(&(self->poollock));
+    return res;
+}
+
+
+/* psyco_conn_instrument() - enable or disable the query statistics */
+
+static char psyco_conn_instrument__doc__[] =
+"Enables (or disables, if the argument is false) the collection of query\n"
+"statistics by this connection and its cursors. Enabling the statistics\n"
+"resets the counters returned by .stats().";
+
+static PyObject *
+psyco_conn_instrument(connobject *self, PyObject *args)
+{
+    int value = 1;
+
+    EXC_IFCLOSED(self);
+    if (!PyArg_ParseTuple(args, "|i", &value)) {
+        return NULL;
+    }
+
+    if (value && !self->instrument) {
+        memset(&(self->stats), 0, sizeof(psyco_stats));
+        self->acquires = self->slow = 0;
+        self->acquiretime = self->acquiremax = 0.0;
+    }
+    self->instrument = value ? 1 : 0;
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+
+/* psyco_conn_stats() - the statistics collected since .instrument() */
+
+static char psyco_conn_stats__doc__[] =
+"Returns a dictionary with the statistics collected since .instrument():\n"
+"the number of queries, the seconds spent executing them, building their\n"
+"descriptions, converting rows and waiting for locks, the rows and bytes\n"
+"converted, the number of slow queries and the number of physical\n"
+"connections obtained from the pool with the total and worst time needed\n"
+"to obtain them.";
+
+static PyObject *
+psyco_conn_stats(connobject *self, PyObject *args)
+{
+    EXC_IFCLOSED(self);
+    PARSEARGS(args);
+
+    return Py_BuildValue("{s:l,s:d,s:d,s:d,s:d,s:l,s:l,s:l,s:l,s:d,s:d}",
+                         "queries", self->stats.queries,
+                         "exectime", self->stats.exectime,
+                         "describetime", self->stats.describetime,
+                         "fetchtime", self->stats.fetchtime,
+                         "lockwait", self->stats.lockwait,
+                         "rows", self->stats.rows,
+                         "bytes", self->stats.bytes,
+                         "slow", self->slow,
+                         "acquires", self->acquires,
+                         "acquiretime", self->acquiretime,
+                         "acquiremax", self->acquiremax);
+}
+
+
+/* psyco_conn_slowlog() - set the slow query log callback */
+
+static char psyco_conn_slowlog__doc__[] =
+"Sets a function called as func(query, seconds, stats) after every query\n"
+"that took at least the given number of seconds (default 1.0) to execute,\n"
+"stats being the cursor's .stats(). None removes the function. Queries\n"
+"are timed only while the connection is instrumented.";
+
+static PyObject *
+psyco_conn_slowlog(connobject *self, PyObject *args)
+{
+    PyObject *func;
+    double seconds = 1.0;
+
+    EXC_IFCLOSED(self);
+    if (!PyArg_ParseTuple(args, "O|d", &func, &seconds)) {
+        return NULL;
+    }
+    if (func != Py_None && !PyCallable_Check(func)) {
+        PyErr_SetString(PyExc_TypeError, "argument 1 must be callable");
+        return NULL;
+    }
+
+    Py_XDECREF(self->slowlog);
+    self->slowlog = NULL;
+    if (func != Py_None) {
+        Py_INCREF(func);
+        self->slowlog = func;
+    }
+    self->slowtime = seconds;
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+
 /**** CONNECTION OBJECT DEFINITION ****/
 
 /* object methods list */
@@ -541,6 +959,14 @@ static struct PyMethodDef psyco_conn_methods[] = {
      METH_VARARGS, psyco_conn_set_isolation_level__doc__},   
     {"serialize", (PyCFunction)psyco_conn_serialize,
      METH_VARARGS, psyco_conn_serialize__doc__},
+    {"pool", (PyCFunction)psyco_conn_pool,
+     METH_VARARGS, psyco_conn_pool__doc__},
+    {"instrument", (PyCFunction)psyco_conn_instrument,
+     METH_VARARGS, psyco_conn_instrument__doc__},
+    {"stats", (PyCFunction)psyco_conn_stats,
+     METH_VARARGS, psyco_conn_stats__doc__},
+    {"slowlog", (PyCFunction)psyco_conn_slowlog,
+     METH_VARARGS, psyco_conn_slowlog__doc__},
     {NULL, NULL}
 };
 
@@ -553,6 +979,8 @@ static struct memberlist psyco_conn_memberlist[] = {
     { "cursors", T_OBJECT, OFFSETOF(cursors), RO},
     { "maxconn", T_INT, OFFSETOF(maxconn), RO},
     { "minconn", T_INT, OFFSETOF(minconn), RO},
+    { "timeout", T_INT, OFFSETOF(timeout), 0},
+    { "idletime", T_INT, OFFSETOF(idletime), 0},
     {NULL}
 };
 
@@ -585,6 +1013,9 @@ psyco_conn_destroy(connobject *self)
 {
     if (self->closed == 0) _psyco_conn_close(self);
     pthread_mutex_destroy(&(self->lock));
+    pthread_mutex_destroy(&(self->poollock));
+    pthread_cond_destroy(&(self->poolcond));
+    Py_XDECREF(self->slowlog);
     free(self->dsn);
     PyObject_Del(self);
     Dprintf("psyco_conn_destroy(): connobject at %p destroyed\n", self);
@@ -627,7 +1058,8 @@ static PyTypeObject Conntype = {
 /* the C constructor for connection objects */
 
 connobject *
-new_psyco_connobject(char *dsn, int maxconn, int minconn, int serialize)
+new_psyco_connobject(char *dsn, int maxconn, int minconn, int serialize,
+                     int timeout, int idletime)
 {
     connobject *self;
 
@@ -642,36 +1074,53 @@ new_psyco_connobject(char *dsn, int maxconn, int minconn, int serialize)
     if (self == NULL) return NULL;
 
     pthread_mutex_init(&(self->lock), NULL);
+    pthread_mutex_init(&(self->poollock), NULL);
+    pthread_cond_init(&(self->poolcond), NULL);
     self->dsn = strdup(dsn);
     self->maxconn = maxconn;       
     self->minconn = minconn;
     self->cursors = PyList_New(0);
-    self->avail_conn = PyList_New(0);
     self->closed = 0;
     self->isolation_level = 2;
     self->serialize = serialize;
+    self->avail = NULL;
+    self->navail = self->nopen = 0;
+    self->timeout = timeout;
+    self->idletime = idletime;
+    self->waits = self->creates = self->destroys = 0;
+    self->instrument = 0;
+    memset(&(self->stats), 0, sizeof(psyco_stats));
+    self->acquires = self->slow = 0;
+    self->acquiretime = self->acquiremax = 0.0;
+    self->slowlog = NULL;
+    self->slowtime = 1.0;
+    self->stdmanager = NULL;
     
     /* allocate default manager thread and keeper */
-    self->stdmanager = new_psyco_cursobject(self, NULL);
+    if (self->cursors)
+        self->stdmanager = new_psyco_cursobject(self, NULL, NULL);
 
     /* error checking done good */
-    if (self->stdmanager == NULL || self->cursors == NULL
-        || self->avail_conn == NULL) {
+    if (self->stdmanager == NULL || self->cursors == NULL) {
         Py_XDECREF(self->cursors);
-        Py_XDECREF(self->avail_conn);
-        Py_XDECREF(self->stdmanager);
+        _pool_close(self);
         pthread_mutex_destroy(&(self->lock));
+        pthread_mutex_destroy(&(self->poollock));
+        pthread_cond_destroy(&(self->poolcond));
+        free(self->dsn);
         PyObject_Del(self);
         return NULL;
     }
 
+    /* open the other minconn connections now instead of on first use */
+    if (_pool_warmup(self) < 0) {
+        Py_DECREF(self);
+        return NULL;
+    }
+
     Dprintf("new_psyco_connobject(): created connobject at %p, refcnt = %d\n",
             self, self->ob_refcnt);
     Dprintf("new_psyco_connobject(): stdmanager = %p, stdkeeper = %p\n",
             self->stdmanager, self->stdmanager->keeper);
     return self;
 }
-
-
-
-
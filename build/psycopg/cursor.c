@@ -33,6 +33,14 @@
 #include "module.h"
 #include "typemod.h"
 #include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#ifndef _WIN32
+#include <unistd.h>
+#include <poll.h>
+#else
+#include <io.h>
+#endif
 
 /* with some versions of postgres we need to include postgres.h to
    get the correct definition for InvalidOid */
@@ -71,6 +79,205 @@ pgconn_set_critical(cursobject *self)
     self->critical = strdup(PQerrorMessage(self->pgconn));
 }
 
+/* _psyco_curs_drain() - discard the result of a prefetched FETCH
+ *
+ * named cursors send the next FETCH before the user asks for it and
+ * asynchronous queries leave their result on the connection until .poll()
+ * collects it; before sending anything else on the connection the pending
+ * result (if any) must be consumed.
+ *
+ * this function does not call Py_*_ALLOW_THREADS macros
+ * this function does not lock the keeper and should be called while
+ *   holding a lock on it
+ */
+static void
+_psyco_curs_drain(cursobject *self)
+{
+    PGresult *pgres;
+
+    if (!self->prefetch && !(self->keeper && self->keeper->async)) return;
+
+    Dprintf("_psyco_curs_drain: discarding pending results\n");
+    while ((pgres = PQgetResult(self->pgconn)) != NULL) PQclear(pgres);
+    self->prefetch = 0;
+    if (self->keeper) self->keeper->async = NULL;
+}
+
+/* _psyco_curs_close_named() - close the server-side cursor, if declared
+ *
+ * errors are ignored: if the transaction was aborted the backend already
+ * closed the cursor for us.
+ *
+ * this function locks the keeper
+ * this function enters an ALLOW_THREADS wrapper
+ */
+static void
+_psyco_curs_close_named(cursobject *self)
+{
+    char *query = NULL;
+    PGresult *pgres = NULL;
+
+    if (!self->declared || !self->keeper || !self->pgconn) return;
+    self->declared = 0;
+
+    if (asprintf(&query, "CLOSE %s", self->name) < 0) return;
+    Dprintf("_psyco_curs_close_named: query = %s\n", query);
+
+    pthread_mutex_lock(&(self->keeper->lock));
+    Py_BEGIN_ALLOW_THREADS;
+    _psyco_curs_drain(self);
+    pgres = PQexec(self->pgconn, query);
+    pthread_mutex_unlock(&(self->keeper->lock));
+    Py_END_ALLOW_THREADS;
+
+    IFCLEARPGRES(pgres);
+    free(query);
+}
+
+/* stmtcache_clear() - invalidate all the statements prepared on a keeper
+ *
+ * if deallocate is true the statements are DEALLOCATEd on the backend too,
+ * using a single query (there is no need to do that when the connection was
+ * reset or is about to be closed.)
+ *
+ * this function does not call Py_*_ALLOW_THREADS macros
+ * this function does not lock the keeper and should be called while
+ *   holding a lock on it (or on a keeper not accessible by other threads)
+ */
+static void
+stmtcache_clear(connkeeper *keeper, int deallocate)
+{
+    stmtentry *entry;
+    PGresult *pgres;
+    char *query = NULL, *c = NULL;
+
+    if (deallocate && keeper->nstmts > 0)
+        query = c = (char *)malloc(keeper->nstmts * 48 + 1);
+
+    while ((entry = keeper->stmts) != NULL) {
+        keeper->stmts = entry->next;
+        if (query) c += sprintf(c, "DEALLOCATE %s;", entry->name);
+        free(entry->operation);
+        free(entry);
+    }
+    keeper->nstmts = 0;
+
+    if (query) {
+        Dprintf("stmtcache_clear: query = >%s<\n", query);
+        pgres = PQexec(keeper->pgconn, query);
+        IFCLEARPGRES(pgres);
+        free(query);
+    }
+}
+
+#if POSTGRESQL_MAJOR >= 8
+/* stmtcache_exec() - execute a statement using the keeper's statement cache
+ *
+ * the statement is looked up by operation and moved to the head of the list
+ * on a hit; on a miss query is PREPAREd, added to the head of the list and
+ * the least recently used statement is DEALLOCATEd if the cache has more
+ * than MAXSTMTS entries. returns the result of the last libpq call.
+ *
+ * a statement deallocated behind our back (DEALLOCATE ALL, DISCARD ALL) is
+ * dropped from the cache; outside of a transaction it is prepared and
+ * executed again, inside one the transaction is already aborted and *lost is
+ * set to let the caller raise a meaningful error.
+ *
+ * this function does not call Py_*_ALLOW_THREADS macros
+ * this function does not lock the keeper and should be called while
+ *   holding a lock on it
+ */
+static PGresult *
+stmtcache_exec(connkeeper *keeper, char *operation, long hash, char *query,
+               int nparams, const char **values, int *lost)
+{
+    stmtentry *entry, **prev;
+    PGresult *pgres;
+    char *state;
+    int retried = 0;
+
+    *lost = 0;
+
+  again:
+    for (prev = &(keeper->stmts); (entry = *prev) != NULL;
+         prev = &(entry->next)) {
+        if (entry->hash == hash && !strcmp(entry->operation, operation))
+            break;
+    }
+
+    if (entry) {
+        Dprintf("stmtcache_exec: hit, statement %s\n", entry->name);
+        keeper->hits++;
+        *prev = entry->next;
+    }
+    else {
+        keeper->misses++;
+        if (!(entry = (stmtentry *)calloc(1, sizeof(stmtentry)))
+            || !(entry->operation = strdup(operation))) {
+            if (entry) free(entry);
+            return NULL;
+        }
+        entry->hash = hash;
+        sprintf(entry->name, "psyco_%d", ++keeper->serial);
+
+        Dprintf("stmtcache_exec: miss, preparing %s as >%s<\n",
+                entry->name, query);
+        pgres = PQprepare(keeper->pgconn, entry->name, query, nparams, NULL);
+        if (pgres == NULL || PQresultStatus(pgres) != PGRES_COMMAND_OK) {
+            free(entry->operation);
+            free(entry);
+            return pgres;
+        }
+        CLEARPGRES(pgres);
+        keeper->nstmts++;
+
+        /* drop the least recently used statement */
+        if (keeper->nstmts > MAXSTMTS) {
+            stmtentry *last, **lprev = &(keeper->stmts);
+            char dealloc[48];
+
+            while ((*lprev)->next) lprev = &((*lprev)->next);
+            last = *lprev;
+            *lprev = NULL;
+            keeper->nstmts--;
+
+            Dprintf("stmtcache_exec: evicting %s\n", last->name);
+            sprintf(dealloc, "DEALLOCATE %s", last->name);
+            pgres = PQexec(keeper->pgconn, dealloc);
+            IFCLEARPGRES(pgres);
+            free(last->operation);
+            free(last);
+        }
+    }
+
+    entry->next = keeper->stmts;
+    keeper->stmts = entry;
+
+    pgres = PQexecPrepared(keeper->pgconn, entry->name, nparams, values,
+                           NULL, NULL, 0);
+
+    /* the statement was deallocated behind our back: forget it */
+    if (pgres && PQresultStatus(pgres) == PGRES_FATAL_ERROR
+        && (state = PQresultErrorField(pgres, PG_DIAG_SQLSTATE))
+        && !strcmp(state, "26000")) {
+        Dprintf("stmtcache_exec: %s lost, retried = %d\n",
+                entry->name, retried);
+        keeper->stmts = entry->next;
+        keeper->nstmts--;
+        free(entry->operation);
+        free(entry);
+
+        if (PQtransactionStatus(keeper->pgconn) == PQTRANS_IDLE && !retried) {
+            PQclear(pgres);
+            retried = 1;
+            goto again;
+        }
+        *lost = 1;
+    }
+    return pgres;
+}
+#endif
+
 /* _psyco_curs_getout() - move the cursor out of the cursor list
  *
  * should be called while holding a lock to the connection
@@ -103,13 +310,12 @@ _psyco_curs_getout(cursobject *self)
  *   only owner of the keeper and after the cursor has been removed from
  *   the connection list of cursors, so it is safe to proceed without locking
  *   the keeper
- * this function locks the connection to access the avail_conn list
+ * this function locks the pool of the connection
  * this function enters an ALLOW_THREADS wrapper
  */
 int
 dispose_pgconn(cursobject *self)
 {
-    PyObject *cpgconn;
     int refcnt, result;
     
     /* if we don't have a connection, print a warning and return */
@@ -118,6 +324,19 @@ dispose_pgconn(cursobject *self)
         return 0;
     }
 
+    /* a server-side cursor declared WITH HOLD survives the rollback below,
+       so we close it explicitly before giving the connection back */
+    if (self->keeper->refcnt == 1) _psyco_curs_close_named(self);
+
+    /* don't leave the result of our asynchronous query to other cursors */
+    if (self->keeper->async == self) {
+        pthread_mutex_lock(&(self->keeper->lock));
+        Py_BEGIN_ALLOW_THREADS;
+        _psyco_curs_drain(self);
+        pthread_mutex_unlock(&(self->keeper->lock));
+        Py_END_ALLOW_THREADS;
+    }
+
     Dprintf("dispose_pgconn: keeper->refcnt = %d\n", self->keeper->refcnt);
     pthread_mutex_lock(&(self->keeper->lock));
     refcnt = --self->keeper->refcnt;    
@@ -137,30 +356,26 @@ dispose_pgconn(cursobject *self)
        the keeper) */
     Py_BEGIN_ALLOW_THREADS;
     result = abort_pgconn(self);
+    stmtcache_clear(self->keeper, result == 0);
     pthread_mutex_unlock(&(self->keeper->lock));
     Py_END_ALLOW_THREADS;
 
     /* now, if we can't get an hold on cursor's connection, that means that
        this cursor was orphaned by the garbage system reclaiming the connection
        object. we don't have a place to put the pgconn back, so we free it */
-    if (result < 0 || !self->conn || !self->conn->avail_conn
-        || self->critical != NULL) {
-        Dprintf("dispose_pgconn: can't find connection or error: "
+    if (!self->conn || !self->conn->cursors) {
+        Dprintf("dispose_pgconn: can't find connection: "
                 "calling PQfinish()\n");
-        PQfinish(self->pgconn);
-        pthread_mutex_destroy(&(self->keeper->lock));
-        free(self->keeper);
+        free_keeper(self->keeper);
+    }
+    else if (result < 0 || self->critical != NULL) {
+        Dprintf("dispose_pgconn: error on connection: discarding keeper\n");
+        pool_discard(self->conn, self->keeper);
     }
     else {
-        pthread_mutex_lock(&(self->conn->lock));
         self->keeper->status = KEEPER_READY;
-        cpgconn = PyCObject_FromVoidPtr((void *)self->keeper, NULL);
-        Dprintf("dispose_pgconn: appending keeper PyCObject to the list\n");
-        PyList_Append(self->conn->avail_conn, cpgconn);
-        Dprintf("dispose_pgconn: cpgconn->refcnt = %d\n",
-                cpgconn->ob_refcnt);
-        Py_DECREF(cpgconn);
-        pthread_mutex_unlock(&(self->conn->lock));
+        Dprintf("dispose_pgconn: giving back keeper to the pool\n");
+        pool_put(self->conn, self->keeper);
     }
     /* clean the cursor before putting it to sleep */
     self->keeper = NULL;
@@ -204,6 +419,8 @@ _psyco_curs_destroy(cursobject *self)
     self->status = Py_None;
     Py_XDECREF(self->casts);
     self->casts = NULL;
+    if (self->castinfo) psyco_free_castinfo(self->castinfo, self->columns);
+    self->castinfo = NULL;
     if (self->notice) free(self->notice);
     self->notice = NULL;
     if (self->critical) free(self->critical);
@@ -221,6 +438,7 @@ psyco_curs_close(cursobject *self, PyObject *args)
     PARSEARGS(args);
     EXC_IFCLOSED(self);
     IFCLEARPGRES(self->pgres);
+    _psyco_curs_close_named(self);
 
     Dprintf("psyco_curs_close: closing cursor at %p\n", self);
     self->closed = 1;
@@ -252,6 +470,47 @@ pgconn_resolve_critical(cursobject *self)
 }
 
 
+/* pgres_set_error() - raise the exception matching an error result
+ *
+ * the query (if not NULL) is appended to the error message; integrity
+ * violations raise IntegrityError, everything else ProgrammingError.
+ */
+static void
+pgres_set_error(PGresult *pgres, char *query)
+{
+    char *pgerr = PQresultErrorMessage(pgres);
+    char *errstr = NULL;
+
+    if (query == NULL) query = "";
+    if (asprintf(&errstr, "%s\n%s", pgerr, query) >= 0) {
+#if POSTGRESQL_MAJOR >= 8 || POSTGRESQL_MINOR >= 4
+        char *pgstate = PQresultErrorField(pgres, PG_DIAG_SQLSTATE);
+
+        /* if pgstate is NULL we are using a new libpq to connect to an
+           old backend; need to account for it to avoid cirillic :)
+           segmentation faults... */
+        if ((pgstate && !strncmp(pgstate, "23", 2))
+            || (!pgstate &&
+             (!strncmp(pgerr, "ERROR:  Cannot insert a duplicate key", 37)
+              || !strncmp(pgerr, "ERROR:  ExecAppend: Fail to add null",36)
+              || strstr(pgerr, "referential integrity violation"))))
+#else       
+        if (!strncmp(pgerr, "ERROR:  Cannot insert a duplicate key", 37)
+            || !strncmp(pgerr, "ERROR:  ExecAppend: Fail to add null", 36)
+            || strstr(pgerr, "referential integrity violation"))
+#endif	
+            PyErr_SetString(IntegrityError, errstr);
+        else
+            PyErr_SetString(ProgrammingError, errstr);
+        free(errstr);
+    }
+    else {
+        PyErr_SetString(ProgrammingError, pgerr);
+    }
+    Dprintf("pgres_set_error: pgerr = %s\n", pgerr);
+}
+
+
 /* commit_pgconn() - try to  commit the transaction
  *
  * this function does not call Py_*_ALLOW_THREADS macros
@@ -272,6 +531,7 @@ commit_pgconn(cursobject *self)
         return 0;
     
     assert(self->pgconn);
+    _psyco_curs_drain(self);
     
     pgres = PQexec(self->pgconn, query);
     if (pgres == NULL) {
@@ -293,6 +553,8 @@ commit_pgconn(cursobject *self)
     self->keeper->status = KEEPER_READY;
     
  cleanup:
+    /* the transaction is over, and so is any cursor not declared WITH HOLD */
+    if (!self->withhold) self->declared = 0;
     IFCLEARPGRES(pgres);
     return retvalue;
 }
@@ -370,6 +632,7 @@ abort_pgconn(cursobject *self)
         return 0;
 
     assert(self->pgconn);
+    _psyco_curs_drain(self);
     
     pgres = PQexec(self->pgconn, query);
     if (pgres == NULL) {
@@ -383,6 +646,7 @@ abort_pgconn(cursobject *self)
         Dprintf("abort_pgconn: result is NOT OK\n");
         pgconn_set_critical(self);
         PQreset(self->pgconn);
+        stmtcache_clear(self->keeper, 0);
         goto cleanup;
     }
     Dprintf("abort_pgconn: result is OK\n");
@@ -392,11 +656,132 @@ abort_pgconn(cursobject *self)
     self->keeper->status = KEEPER_READY;
     
  cleanup:
+    /* the transaction is over, and so is any cursor not declared WITH HOLD */
+    if (!self->withhold) self->declared = 0;
     IFCLEARPGRES(pgres);
     return retvalue;
 }
 
 
+#if POSTGRESQL_MAJOR > 8 || (POSTGRESQL_MAJOR == 8 && POSTGRESQL_MINOR >= 2)
+/* _pgconn_option() - the value of an option returned by libpq, if set */
+static const char *
+_pgconn_option(PQconninfoOption *opts, const char *keyword)
+{
+    PQconninfoOption *o;
+
+    for (o = opts; o && o->keyword; o++) {
+        if (!strcmp(o->keyword, keyword) && o->val && *(o->val))
+            return o->val;
+    }
+    return NULL;
+}
+#endif
+
+/* pgconn_timeout() - the connect_timeout of a connection, in seconds
+ *
+ * the value is asked to libpq, so that it comes from the dsn (in any of its
+ * forms), the service file or the environment exactly as libpq sees it;
+ * returns 0 (wait forever) if no timeout is set. like libpq, 1 second is
+ * raised to 2. before 9.3 libpq can only parse the dsn and give the defaults
+ * (the environment), before 8.2 there is no timeout.
+ */
+static int
+pgconn_timeout(PGconn *pgconn, const char *dsn)
+{
+    int timeout = 0;
+#if POSTGRESQL_MAJOR > 9 || (POSTGRESQL_MAJOR == 9 && POSTGRESQL_MINOR >= 3)
+    PQconninfoOption *opts;
+    const char *val;
+
+    if ((opts = PQconninfo(pgconn)) != NULL) {
+        if ((val = _pgconn_option(opts, "connect_timeout")) != NULL)
+            timeout = atoi(val);
+        PQconninfoFree(opts);
+    }
+#elif POSTGRESQL_MAJOR > 8 || (POSTGRESQL_MAJOR == 8 && POSTGRESQL_MINOR >= 2)
+    PQconninfoOption *opts;
+    const char *val = NULL;
+    int i;
+
+    for (i = 0; i < 2 && val == NULL; i++) {
+        opts = i == 0 ? PQconninfoParse(dsn, NULL) : PQconndefaults();
+        if (opts == NULL) continue;
+        if ((val = _pgconn_option(opts, "connect_timeout")) != NULL)
+            timeout = atoi(val);
+        PQconninfoFree(opts);
+    }
+#endif
+
+    if (timeout < 0) timeout = 0;
+    else if (timeout == 1) timeout = 2;
+    Dprintf("pgconn_timeout: connect_timeout = %d\n", timeout);
+    return timeout;
+}
+
+/* pgconn_connect() - open a connection without blocking other threads
+ *
+ * the connection is started with PQconnectStart() and driven with
+ * PQconnectPoll(), waiting on the socket with poll() (select() on win32)
+ * until the connect_timeout of the dsn expires; returns NULL only if libpq
+ * can't allocate the connection (check PQstatus() otherwise) and sets
+ * *timedout if the connection was abandoned because of the timeout. only
+ * the other threads run meanwhile: the calling one waits for the connection
+ * (there is no asynchronous connect at the python level).
+ *
+ * this function does not call Py_*_ALLOW_THREADS macros and should be
+ *   called from inside an ALLOW_THREADS wrapper
+ */
+static PGconn *
+pgconn_connect(const char *dsn, int *timedout)
+{
+    PGconn *pgconn;
+    PostgresPollingStatusType pollstatus = PGRES_POLLING_WRITING;
+    double deadline = 0.0, left = 0.0;
+    int fd, rv, timeout;
+#ifndef _WIN32
+    struct pollfd pfd;
+#else
+    fd_set fds;
+    struct timeval tv;
+#endif
+
+    *timedout = 0;
+    if ((pgconn = PQconnectStart(dsn)) == NULL) return NULL;
+    if (PQstatus(pgconn) == CONNECTION_BAD) return pgconn;
+    if ((timeout = pgconn_timeout(pgconn, dsn)) > 0)
+        deadline = psyco_gettime() + timeout;
+
+    while (pollstatus != PGRES_POLLING_OK
+           && pollstatus != PGRES_POLLING_FAILED) {
+        if (deadline > 0.0 && (left = deadline - psyco_gettime()) <= 0.0) {
+            *timedout = 1;
+            break;
+        }
+        fd = PQsocket(pgconn);
+#ifndef _WIN32
+        pfd.fd = fd;
+        pfd.events = pollstatus == PGRES_POLLING_READING ? POLLIN : POLLOUT;
+        pfd.revents = 0;
+        rv = poll(&pfd, 1, deadline > 0.0 ? (int)(left * 1000.0) + 1 : -1);
+#else
+        FD_ZERO(&fds);
+        FD_SET(fd, &fds);
+        tv.tv_sec = (long)left;
+        tv.tv_usec = (long)((left - tv.tv_sec) * 1000000.0);
+        if (pollstatus == PGRES_POLLING_READING)
+            rv = select(fd + 1, &fds, NULL, NULL, deadline > 0.0 ? &tv : NULL);
+        else
+            rv = select(fd + 1, NULL, &fds, NULL, deadline > 0.0 ? &tv : NULL);
+#endif
+        if (rv < 0 && errno != EINTR) break;
+        if (rv > 0) pollstatus = PQconnectPoll(pgconn);
+    }
+    Dprintf("pgconn_connect: polling ended with status %d\n", pollstatus);
+    return pgconn;
+}
+
+
 /* alloc_keeper() - allocate a new connection
  *
  * this function is used by both request_pgconn() and new_psyco_connobject()
@@ -411,23 +796,33 @@ alloc_keeper(connobject *conn)
     PGresult *pgres;
     connkeeper *keeper;
     const char *datestyle = "SET DATESTYLE TO 'ISO'";
+    int timedout;
     
     Dprintf("alloc_keeper: opening new postgresql connection\n");
     Dprintf("alloc_keeper: dsn = %s (%p)\n", conn->dsn, conn->dsn);
 
-    pgconn = PQconnectdb(conn->dsn);
+    Py_BEGIN_ALLOW_THREADS;
+    pgconn = pgconn_connect(conn->dsn, &timedout);
+    Py_END_ALLOW_THREADS;
         
     Dprintf("alloc_keeper: new posgresql connection at %p\n", pgconn);
         
     if (pgconn == NULL)
     {
-        Dprintf("alloc_keeper: PQconnectdb(%s) failed\n", conn->dsn);
-        PyErr_SetString(OperationalError, "PQconnectdb() failed");
+        Dprintf("alloc_keeper: PQconnectStart(%s) failed\n", conn->dsn);
+        PyErr_SetString(OperationalError, "PQconnectStart() failed");
+        return NULL;
+    }
+    else if (timedout)
+    {
+        Dprintf("alloc_keeper: connection to %s timed out\n", conn->dsn);
+        PyErr_SetString(OperationalError, "timeout expired");
+        PQfinish(pgconn);
         return NULL;
     }
-    else if (PQstatus(pgconn) == CONNECTION_BAD)
+    else if (PQstatus(pgconn) != CONNECTION_OK)
     {
-        Dprintf("alloc_keeper: PQconnectdb(%s) returned BAD\n", conn->dsn);
+        Dprintf("alloc_keeper: PQconnectPoll(%s) returned BAD\n", conn->dsn);
         PyErr_SetString(OperationalError, PQerrorMessage(pgconn));
         PQfinish(pgconn);
         return NULL;
@@ -442,7 +837,9 @@ alloc_keeper(connobject *conn)
 #endif
     
     Dprintf("alloc_keeper: setting datestyle to iso\n");
+    Py_BEGIN_ALLOW_THREADS;
     pgres = PQexec(pgconn, datestyle);
+    Py_END_ALLOW_THREADS;
     Dprintf("alloc_keeper: datestyle query executed\n");
     
     if (pgres == NULL || PQresultStatus(pgres) != PGRES_COMMAND_OK ) {
@@ -465,111 +862,43 @@ alloc_keeper(connobject *conn)
 }
 
 
-/* _extract_keeper() - extract a connection from the list and free Py_CObject
+/* free_keeper() - close the connection and free a keeper
  *
- * this function does not call Py_*_ALLOW_THREADS macros
- * this function should be called with a lock on the connection object
+ * this function can be called without any lock because operates on a
+ *   keeper not in any list and not used by any cursor
  */
-inline static connkeeper *
-_extract_keeper(connobject *c)
+void
+free_keeper(connkeeper *keeper)
 {
-    PyObject *conn;
-    connkeeper *keeper;
-    
-    if (!(conn = PyList_GetItem(c->avail_conn, 0))) return NULL;
-    Py_INCREF(conn);
-    PySequence_DelItem(c->avail_conn, 0);
-    keeper = (connkeeper *)PyCObject_AsVoidPtr(conn);
-    Dprintf("_extract_pgconn: keeper at %p, conn->refcnt = %d\n",
-            keeper, conn->ob_refcnt);
-    Py_DECREF(conn);
-    return keeper;
+    Dprintf("free_keeper: destroying keeper at %p\n", keeper);
+    stmtcache_clear(keeper, 0);
+    PQfinish(keeper->pgconn);
+    pthread_mutex_destroy(&(keeper->lock));
+    free(keeper);
 }
 
 
 /* request_pgconn() - request a new physical postgresql connection
  *
- * this function tries to get a connection from the list of available
- * connections. if the list is empty, it creates a new connection and
- * immediately use it. if, after obtaining the connection, the number of
- * available connections is still > connobject->minconn, close and free one of
- * the connections. returns -1 on error (connobject->maxconn reached) and 0 if
- * successful.
+ * this function gets a connection from the pool of the connection object,
+ * see pool_get(). returns -1 on error (no connection available before the
+ * pool timeout) and 0 if successful.
  *
- * this function locks the new keeper
- * this function should be called with the connection locked
+ * this function locks the pool
  * this function enters an ALLOW_THREADS wrapper
  */
 
 static int
 request_pgconn(cursobject *self)
 {
-    connobject *owner_conn;
     connkeeper *keeper;
-    int ncursor_conn, navail_conn, nopen_conn;
 
     /* if we return an error, we want the cursor's postgres connection to
        be set to NULL */
     self->pgconn = NULL;
     self->keeper = NULL;
 
-    /* the owner connection of the current cursor */
-    owner_conn = self->conn;
-    
-    ncursor_conn = PyList_Size(owner_conn->cursors);
-    navail_conn = PyList_Size(owner_conn->avail_conn);
-    nopen_conn = ncursor_conn + navail_conn;
-    
-    Dprintf("request_pgconn: maxconn = %d, minconn = %d, openconn = %d, "
-            "availconn = %d\n", owner_conn->maxconn, owner_conn->minconn,
-            nopen_conn, navail_conn);
-
-    /* if we have at least 1 connection available we use it */
-    if (navail_conn > 0) {
-        Dprintf("request_pgconn: we have %d available connections\n",
-                navail_conn);
-
-        if (!(keeper = _extract_keeper(owner_conn))) {
-            return -1;
-        }   
-        
-        /* if there are more connections than the minimum number, we close one
-           (we ask for another connection and, if we can get it we close it,
-            just to not let the number of connections grow without control) */
-        if (--navail_conn > owner_conn->minconn) {
-            connkeeper *closing = _extract_keeper(owner_conn);
-            if (closing) {
-                Dprintf("request_pgconn: destoying keeper at %p\n", keeper);
-                PQfinish(closing->pgconn);
-                pthread_mutex_destroy(&(closing->lock));
-                free(closing);
-            }
-        }
-    }
-
-    /* if we don't have any free connection we allocate one, provided the
-       number of total connections does not exceed maxconn */
-    else if (nopen_conn  < owner_conn->maxconn) {
-        keeper = alloc_keeper(owner_conn);
-        if (!keeper) return -1;
-    }
-    
-    else {
-        char *errstr = NULL;
-        int memerr;
-
-        memerr = asprintf(&errstr, "too many open connections: %i\n"
-                          "Try increasing maximum number of physical "
-                          "connections when calling connect()", nopen_conn);
-        if (memerr < 0) {
-            PyErr_SetFromErrno(OperationalError);
-        }
-        else {
-            PyErr_SetString(OperationalError, errstr);
-            free(errstr);
-        }
-        return -1;
-    }
+    if (!(keeper = pool_get(self->conn))) return -1;
 
     keeper->refcnt = 1;
     self->keeper = keeper;
@@ -624,6 +953,9 @@ psyco_curs_reset(cursobject *self, int resetconn)
     self->notuples = 1;
     self->rowcount = -1;
     self->row = 0;
+    self->ntuples = 0;
+    self->serverside = 0;
+    memset(&(self->stats), 0, sizeof(psyco_stats));
     
     Py_XDECREF(self->description);
     Py_INCREF(Py_None);
@@ -635,6 +967,8 @@ psyco_curs_reset(cursobject *self, int resetconn)
 
     Py_XDECREF(self->casts);
     self->casts = NULL;
+    if (self->castinfo) psyco_free_castinfo(self->castinfo, self->columns);
+    self->castinfo = NULL;
 
     if (resetconn) {
         pthread_mutex_lock(&(self->keeper->lock));
@@ -711,223 +1045,463 @@ psyco_curs_commit(cursobject *self, PyObject *args) {
 }
 
 
-/* _psyco_curs_execute() - execute a query and parse results, used by both the
-   .execute() and the .callproc() methods */
+/**** INSTRUMENTATION ****/
+
+/* add value to a counter of both the cursor and its connection; must be
+   used with the global interpreter lock held */
+#define STATS_ADD(self, field, value) do { \
+        (self)->stats.field += (value); \
+        (self)->conn->stats.field += (value); \
+    } while (0)
+
+/* _psyco_curs_stats() - build the dictionary returned by .stats() */
 static PyObject *
-_psyco_curs_execute(cursobject *self, char *query,
-                    _psyco_curs_execute_callback cb, PyObject *cb_args)
+_psyco_curs_stats(cursobject *self)
 {
-    int pgstatus, old_keeper_status;
-    PyObject *res = NULL;
-    
-    /* even if we fail, we remove any information about the previous query */
-    psyco_curs_reset(self, 0);
-
-    /* if the status of the connection is critical raise an exception */
-    EXC_IFCRITICAL(self);
+    return Py_BuildValue("{s:l,s:d,s:d,s:d,s:d,s:l,s:l}",
+                         "queries", self->stats.queries,
+                         "exectime", self->stats.exectime,
+                         "describetime", self->stats.describetime,
+                         "fetchtime", self->stats.fetchtime,
+                         "lockwait", self->stats.lockwait,
+                         "rows", self->stats.rows,
+                         "bytes", self->stats.bytes);
+}
 
-    assert(self->pgconn);
-    if (PQstatus(self->pgconn) != CONNECTION_OK) {
-        Dprintf("_psyco_curs_execute: connection NOT OK\n");
-        PyErr_SetString(OperationalError, PQerrorMessage(self->pgconn));
-        /* the connection is probably dead! bail out NOW! */
-        return NULL;
-    }
-    Dprintf("_psyco_curs_execute: connection at %p OK\n", self->pgconn);
+/* _psyco_curs_account() - count a completed query and log it if slow
+ *
+ * the slow query log of the connection gets the time spent waiting for the
+ * keeper, executing the query and building its description; exceptions
+ * raised by the log are printed and ignored, the query did succeed.
+ */
+static void
+_psyco_curs_account(cursobject *self, char *query)
+{
+    PyObject *func, *res;
+    double elapsed;
+
+    STATS_ADD(self, queries, 1);
+
+    func = self->conn->slowlog;
+    elapsed = self->stats.lockwait + self->stats.exectime
+        + self->stats.describetime;
+    if (func == NULL || elapsed < self->conn->slowtime) return;
+
+    Dprintf("_psyco_curs_account: slow query (%f s) = >%s<\n",
+            elapsed, query);
+    self->conn->slow++;
+
+    Py_INCREF(func);
+    res = PyObject_CallFunction(func, "sdN", query, elapsed,
+                                _psyco_curs_stats(self));
+    if (res == NULL) PyErr_WriteUnraisable(func);
+    Py_XDECREF(res);
+    Py_DECREF(func);
+}
 
-    pthread_mutex_lock(&(self->keeper->lock));
-    Py_BEGIN_ALLOW_THREADS;
-    Dprintf("_psyco_curs_execute: query = >%s<\n", query);
-    begin_pgconn(self);
-    IFCLEARPGRES(self->pgres);
-    self->pgres = PQexec(self->pgconn, query);
-    Dprintf("_psyco_curs_execute: query executed\n");
-    pthread_mutex_unlock(&(self->keeper->lock));
-    Py_END_ALLOW_THREADS;
+/* _psyco_curs_fetched() - account for the conversion of n rows
+ *
+ * the rows start at first and the conversion started at the time start.
+ */
+static void
+_psyco_curs_fetched(cursobject *self, long int first, long int n,
+                    double start)
+{
+    double elapsed = psyco_gettime() - start;
+    long int row, bytes = 0;
+    int col;
 
-    /* check for PGRES_FATAL_ERROR result */
-    if (self->pgres == NULL) {
-        pgconn_set_critical(self);
-        return pgconn_resolve_critical(self);
+    for (row = first; row < first + n; row++) {
+        for (col = 0; col < self->columns; col++)
+            bytes += PQgetlength(self->pgres, row, col);
     }
 
-    /* now we set the status to LOCKED, to avoid unwanted commits or rollbacks
-       from other threads. if another thread expect to sync *everything* with
-       a single call to .commit() on the connection, it better has to sync
-       with us. because us and him are about to work on the same keeper,
-       setting status to LOCKED is like shifting *our* execution time a little
-       bit in the future... */
-    pthread_mutex_lock(&(self->keeper->lock));
-    old_keeper_status = self->keeper->status;
-    self->keeper->status = KEEPER_LOCKED;
-    pthread_mutex_unlock(&(self->keeper->lock));
-    
-    pgstatus = PQresultStatus(self->pgres);
-    
-    switch(pgstatus) {
+    STATS_ADD(self, fetchtime, elapsed);
+    STATS_ADD(self, rows, n);
+    STATS_ADD(self, bytes, bytes);
+}
 
-        /* send data to the backend */
-    case PGRES_COPY_OUT:
-        Dprintf("_psyco_curs_execute: command returned COPY_OUT\n");
-        /* fall through to the COPY_IN */
 
-        /* data from the backend */
-    case PGRES_COPY_IN:
-        Dprintf("_psyco_curs_execute: command returned COPY_IN\n");
-        
-        /* call the callback */
-        if (cb && cb_args) {
-            res = cb(self, cb_args);
-            if (PyErr_Occurred()) {
-                Py_XDECREF(res);
-                goto error;
-            }
+/* _psyco_curs_describe() - build description and casts from self->pgres
+ *
+ * used by _psyco_curs_execute() on every query returning tuples and by named
+ * cursors on the first FETCH after the DECLARE.
+ *
+ * this function does not call Py_*_ALLOW_THREADS macros
+ */
+static void
+_psyco_curs_describe(cursobject *self)
+{
+    int i, pgnfields = PQnfields(self->pgres);
+    int pgbintuples = PQbinaryTuples(self->pgres);
+    int ntuples = PQntuples(self->pgres);
+    int *dsize = NULL;
+    double start = 0.0;
+
+    if (self->conn->instrument) start = psyco_gettime();
+    self->notuples = 0;
+
+    /* create the tuple for description and typecasting */
+    Py_XDECREF(self->description); Py_XDECREF(self->casts);
+    self->description = PyTuple_New(pgnfields);
+    self->casts = PyTuple_New(pgnfields);
+    if (self->castinfo) psyco_free_castinfo(self->castinfo, self->columns);
+    self->columns = pgnfields;
+    self->castinfo = (psyco_CastInfo *)calloc(pgnfields > 0 ? pgnfields : 1,
+                                              sizeof(psyco_CastInfo));
+
+    /* backend status message */
+    Py_XDECREF(self->status);
+    self->status = PyString_FromString(PQcmdStatus(self->pgres));
+    
+    /* Calculate the display size for each column */
+#ifndef NO_DISPLAY_SIZE
+    dsize = (int *)calloc(pgnfields, sizeof(int));
+    if (dsize != NULL) {
+        if (ntuples == 0) {
+            for (i=0; i < pgnfields; i++)
+                dsize[i] = -1;
         }
         else {
-            PyErr_SetString(ProgrammingError,
-                            "COPY TO/COPY FROM can't be used in .execute()");
-            goto error;
+            int j, len;
+            for (j = 0; j < ntuples; j++) {
+                for (i = 0; i < pgnfields; i++) {
+                    len = PQgetlength(self->pgres, j, i);
+                    if (len > dsize[i]) dsize[i] = len;
+                }
+            }
         }
-        break;
-
-        /* tuples, this was a select */
-    case PGRES_TUPLES_OK: {
-        int i, pgnfields = PQnfields(self->pgres);
-        int pgbintuples = PQbinaryTuples(self->pgres);
-        int *dsize = NULL;
-
-        self->notuples = 0;
-        self->rowcount = PQntuples(self->pgres);
-        
-        Dprintf("_psyco_curs_execute: got %ld tuples\n", self->rowcount);
-
-        /* create the tuple for description and typecasting */
-        Py_XDECREF(self->description); Py_XDECREF(self->casts);
-        self->description = PyTuple_New(pgnfields);
-        self->casts = PyTuple_New(pgnfields);
-        self->columns = pgnfields;
-
-        /* backend status message */
-        Py_XDECREF(self->status);
-        self->status = PyString_FromString(PQcmdStatus(self->pgres));
-        
-		/* Calculate the display size for each column */
-#ifndef NO_DISPLAY_SIZE
-		dsize = (int *)calloc(pgnfields, sizeof(int));
-		if (dsize != NULL) {
-			if (self->rowcount == 0) {
-				for (i=0; i < pgnfields; i++)
-					dsize[i] = -1;
-			}
-			else {
-				int j, len;
-				for (j = 0; j < self->rowcount; j++) {
-					for (i = 0; i < pgnfields; i++) {
-                         len = PQgetlength(self->pgres, j, i);
-                         if (len > dsize[i]) dsize[i] = len;
-                    }
-				}
-			}
-		}
+    }
 #endif
 
-        for (i = 0; i < pgnfields; i++) {
-            /* int j, len = 0, maxl = 0; */
-            Oid ftype = PQftype(self->pgres, i);
-            int fsize = PQfsize(self->pgres, i);
-            int fmod =  PQfmod(self->pgres, i);
-            
-            PyObject *dtitem = PyTuple_New(7);
-            PyObject *type = PyInt_FromLong(ftype);
-            PyObject *cast;
-
-            PyTuple_SET_ITEM(self->description, i, dtitem);
-
-            /* fill the right cast function by accessing the global
-               dictionary of casting objects.  If we got no defined cast
-               use the default one.
-            */
-            if (!(cast = PyDict_GetItem(psyco_types, type))) {
-                Dprintf("_psyco_curs_execute: cast %d not found, using "
-                        "default\n", PQftype(self->pgres,i));
+    for (i = 0; i < pgnfields; i++) {
+        /* int j, len = 0, maxl = 0; */
+        Oid ftype = PQftype(self->pgres, i);
+        int fsize = PQfsize(self->pgres, i);
+        int fmod =  PQfmod(self->pgres, i);
+        
+        PyObject *dtitem = PyTuple_New(7);
+        PyObject *type = PyInt_FromLong(ftype);
+        PyObject *cast;
+
+        PyTuple_SET_ITEM(self->description, i, dtitem);
+
+        /* fill the right cast function by accessing the global
+           dictionary of casting objects.  If we got no defined cast
+           use the default one.
+        */
+        if (!(cast = PyDict_GetItem(psyco_types, type))) {
+            Dprintf("_psyco_curs_describe: cast %d not found, using "
+                    "default\n", PQftype(self->pgres,i));
+            cast = psyco_default_cast;
+        }
+        /* else if we got binary tuples and if we got a field that
+           is binary use the default cast.
+        */
+        else if (pgbintuples && cast == psyco_binary_cast) {
+            Dprintf("_psyco_curs_describe: Binary cursor and "
+                    "binary field: %i using default cast\n",
+                    PQftype(self->pgres,i));
                 cast = psyco_default_cast;
-            }
-            /* else if we got binary tuples and if we got a field that
-               is binary use the default cast.
-            */
-            else if (pgbintuples && cast == psyco_binary_cast) {
-                Dprintf("_psyco_curs_execute: Binary cursor and "
-                        "binary field: %i using default cast\n",
-                        PQftype(self->pgres,i));
-                    cast = psyco_default_cast;
-            }
-            Dprintf("_psyco_curs_execute: using cast at %p for type %d\n",
-                    cast, PQftype(self->pgres,i));
-            Py_INCREF(cast);
-            PyTuple_SET_ITEM(self->casts, i, cast);
-
-            /* fill the other fields */
-            PyTuple_SET_ITEM(dtitem, 0,
-                             PyString_FromString(PQfname(self->pgres, i)));
-            PyTuple_SET_ITEM(dtitem, 1, type);
-
-            /* display size is the maximum size of this field
-               result tuples. */
-            if (dsize && dsize[i] >= 0) {
-                PyTuple_SET_ITEM(dtitem, 2, PyInt_FromLong(dsize[i]));
-            }
-            else {
-                Py_INCREF(Py_None);
-                PyTuple_SET_ITEM(dtitem, 2, Py_None);
-            }
-
-            /* size on the backend */
-            if (fmod > 0) fmod = fmod - sizeof(int);
-            if (fsize == -1) {
-                if (ftype == NUMERICOID) {
-                    PyTuple_SET_ITEM(dtitem, 3,
-                                     PyInt_FromLong((fmod >> 16) & 0xFFFF));
-                }
-                else { /* If variable length record, return maximum size */
-                    PyTuple_SET_ITEM(dtitem, 3, PyInt_FromLong(fmod));
-                }
-            }
-            else {
-                PyTuple_SET_ITEM(dtitem, 3, PyInt_FromLong(fsize));
-            }
+        }
+        Dprintf("_psyco_curs_describe: using cast at %p for type %d\n",
+                cast, PQftype(self->pgres,i));
+        Py_INCREF(cast);
+        PyTuple_SET_ITEM(self->casts, i, cast);
+        if (self->castinfo)
+            psyco_get_castinfo(cast, &(self->castinfo[i]), self->datememo);
+
+        /* fill the other fields (the name is interned because it is used as
+           the key of every row returned by dictfetch*()) */
+        PyTuple_SET_ITEM(dtitem, 0,
+                         PyString_InternFromString(PQfname(self->pgres, i)));
+        PyTuple_SET_ITEM(dtitem, 1, type);
+
+        /* display size is the maximum size of this field
+           result tuples. */
+        if (dsize && dsize[i] >= 0) {
+            PyTuple_SET_ITEM(dtitem, 2, PyInt_FromLong(dsize[i]));
+        }
+        else {
+            Py_INCREF(Py_None);
+            PyTuple_SET_ITEM(dtitem, 2, Py_None);
+        }
 
+        /* size on the backend */
+        if (fmod > 0) fmod = fmod - sizeof(int);
+        if (fsize == -1) {
             if (ftype == NUMERICOID) {
-                /* precision */
-                PyTuple_SET_ITEM(dtitem, 4,
+                PyTuple_SET_ITEM(dtitem, 3,
                                  PyInt_FromLong((fmod >> 16) & 0xFFFF));
-
-                /* scale */
-                PyTuple_SET_ITEM(dtitem, 5,
-                                 PyInt_FromLong((fmod & 0xFFFF) - 4));
             }
+            else { /* If variable length record, return maximum size */
+                PyTuple_SET_ITEM(dtitem, 3, PyInt_FromLong(fmod));
+            }
+        }
+        else {
+            PyTuple_SET_ITEM(dtitem, 3, PyInt_FromLong(fsize));
+        }
 
-            else {
-                /* scale */
-                Py_INCREF(Py_None);
-                PyTuple_SET_ITEM(dtitem, 4, Py_None);
+        if (ftype == NUMERICOID) {
+            /* precision */
+            PyTuple_SET_ITEM(dtitem, 4,
+                             PyInt_FromLong((fmod >> 16) & 0xFFFF));
 
-                /* precision */
-                Py_INCREF(Py_None);
-                PyTuple_SET_ITEM(dtitem, 5, Py_None);
-            }
+            /* scale */
+            PyTuple_SET_ITEM(dtitem, 5,
+                             PyInt_FromLong((fmod & 0xFFFF) - 4));
+        }
+
+        else {
+            /* scale */
+            Py_INCREF(Py_None);
+            PyTuple_SET_ITEM(dtitem, 4, Py_None);
 
-            /* FIXME: null_ok??? */
+            /* precision */
             Py_INCREF(Py_None);
-            PyTuple_SET_ITEM(dtitem, 6, Py_None);
+            PyTuple_SET_ITEM(dtitem, 5, Py_None);
         }
-        
-		if (dsize) free(dsize);
+
+        /* FIXME: null_ok??? */
+        Py_INCREF(Py_None);
+        PyTuple_SET_ITEM(dtitem, 6, Py_None);
+    }
+    
+    if (dsize) free(dsize);
+
+    if (self->conn->instrument)
+        STATS_ADD(self, describetime, psyco_gettime() - start);
+}
+
+
+/* out-of-band parameters for _psyco_curs_execute()
+ *
+ * the query is sent with PQexecParams() or, if operation is not NULL, using
+ * the statement cache of the keeper (operation and hash are the cache key.)
+ * if batch is not NULL the query is instead a batch of statements built by
+ * _psyco_curs_executebatch(), batch being the offsets of the statements and
+ * nparams their number; failed is set to the index of the statement that
+ * produced the result. lost is set if the cached statement was deallocated
+ * by someone else inside a transaction (see stmtcache_exec().)
+ */
+typedef struct {
+    char        *operation;
+    long         hash;
+    int          nparams;
+    const char **values;
+    int         *batch;
+    int          failed;
+    int          lost;
+} _psyco_curs_params;
+
+/* _psyco_curs_exec_batch() - execute the statements joined in query
+ *
+ * the statements are sent with a single PQsendQuery() but the results are
+ * read one at a time: the backend returns a result for every statement and
+ * stops at the first error, so we know which statement failed. returns the
+ * first error (or the last result) and stores in *failed the index of the
+ * statement that produced it.
+ *
+ * this function does not call Py_*_ALLOW_THREADS macros
+ * this function does not lock the keeper and should be called while
+ *   holding a lock on it
+ */
+static PGresult *
+_psyco_curs_exec_batch(PGconn *pgconn, char *query, int *failed)
+{
+    PGresult *pgres, *last = NULL;
+    int pgstatus, i = 0;
+#if POSTGRESQL_MAJOR >= 8
+    char *buf;
+#endif
+
+    *failed = 0;
+    if (!PQsendQuery(pgconn, query)) return NULL;
+
+    while ((pgres = PQgetResult(pgconn)) != NULL) {
+        pgstatus = PQresultStatus(pgres);
+
+        /* COPY is not supported in a batch: get the connection out of it
+           and keep the result, so that _psyco_curs_result() raises */
+#if POSTGRESQL_MAJOR >= 8
+        if (pgstatus == PGRES_COPY_IN) {
+            PQputCopyEnd(pgconn, "COPY is not supported by executemany()");
+        }
+        else if (pgstatus == PGRES_COPY_OUT) {
+            while (PQgetCopyData(pgconn, &buf, 0) > 0) PQfreemem(buf);
+        }
+#endif
+        if (last == NULL || PQresultStatus(last) != PGRES_FATAL_ERROR) {
+            IFCLEARPGRES(last);
+            last = pgres;
+            *failed = i;
+        }
+        else {
+            PQclear(pgres);
+        }
+        if (pgstatus != PGRES_COPY_IN && pgstatus != PGRES_COPY_OUT) i++;
+    }
+    return last;
+}
+
+static PyObject *
+_psyco_curs_result(cursobject *self, char *query,
+                   _psyco_curs_execute_callback cb, PyObject *cb_args);
+
+/* _psyco_curs_execute() - execute a query and parse results, used by both the
+   .execute() and the .callproc() methods */
+static PyObject *
+_psyco_curs_execute(cursobject *self, char *query, _psyco_curs_params *params,
+                    _psyco_curs_execute_callback cb, PyObject *cb_args)
+{
+    PyObject *res;
+    double start = 0.0, locked = 0.0, executed = 0.0;
+    int instrument = self->conn->instrument;
+
+    /* even if we fail, we remove any information about the previous query */
+    psyco_curs_reset(self, 0);
+
+    /* if the status of the connection is critical raise an exception */
+    EXC_IFCRITICAL(self);
+    EXC_IFASYNC(self);
+
+    assert(self->pgconn);
+    if (PQstatus(self->pgconn) != CONNECTION_OK) {
+        Dprintf("_psyco_curs_execute: connection NOT OK\n");
+        PyErr_SetString(OperationalError, PQerrorMessage(self->pgconn));
+        /* the connection is probably dead! bail out NOW! */
+        return NULL;
+    }
+    Dprintf("_psyco_curs_execute: connection at %p OK\n", self->pgconn);
+
+    if (instrument) start = psyco_gettime();
+    pthread_mutex_lock(&(self->keeper->lock));
+    Py_BEGIN_ALLOW_THREADS;
+    if (instrument) locked = psyco_gettime();
+    Dprintf("_psyco_curs_execute: query = >%s<\n", query);
+    _psyco_curs_drain(self);
+    begin_pgconn(self);
+    IFCLEARPGRES(self->pgres);
+    if (params == NULL) {
+        self->pgres = PQexec(self->pgconn, query);
+    }
+    else if (params->batch) {
+        self->pgres = _psyco_curs_exec_batch(self->pgconn, query,
+                                             &(params->failed));
     }
-		break;
+#if POSTGRESQL_MAJOR >= 8
+    else if (params->operation) {
+        self->pgres = stmtcache_exec(self->keeper, params->operation,
+                                     params->hash, query, params->nparams,
+                                     params->values, &(params->lost));
+    }
+    else {
+        self->pgres = PQexecParams(self->pgconn, query, params->nparams, NULL,
+                                   params->values, NULL, NULL, 0);
+    }
+#endif
+    Dprintf("_psyco_curs_execute: query executed\n");
+    if (instrument) executed = psyco_gettime();
+    pthread_mutex_unlock(&(self->keeper->lock));
+    Py_END_ALLOW_THREADS;
+
+    if (instrument) {
+        STATS_ADD(self, lockwait, locked - start);
+        STATS_ADD(self, exectime, executed - locked);
+    }
+
+#if POSTGRESQL_MAJOR >= 8
+    /* not an error in the query: tell the user what to do about it */
+    if (params && params->operation && params->lost) {
+        PyErr_SetString(OperationalError, "prepared statement deallocated "
+                        "by the backend (DEALLOCATE ALL or DISCARD ALL?) and "
+                        "transaction aborted: rollback and execute again");
+        CLEARPGRES(self->pgres);
+        return NULL;
+    }
+#endif
+
+    /* errors in a batch report only the statement that failed */
+    if (params && params->batch && self->pgres
+        && PQresultStatus(self->pgres) == PGRES_FATAL_ERROR
+        && params->failed < params->nparams) {
+        query[params->batch[params->failed + 1] - 2] = '\0';
+        query += params->batch[params->failed];
+    }
+
+    res = _psyco_curs_result(self, query, cb, cb_args);
+    if (instrument && res) _psyco_curs_account(self, query);
+    return res;
+}
+
+
+/* _psyco_curs_result() - parse the result of a query
+ *
+ * the result in self->pgres comes from _psyco_curs_execute() or from the
+ * .poll() method for asynchronous queries; query is used in error messages.
+ */
+static PyObject *
+_psyco_curs_result(cursobject *self, char *query,
+                   _psyco_curs_execute_callback cb, PyObject *cb_args)
+{
+    int pgstatus, old_keeper_status;
+    PyObject *res = NULL;
+
+    /* check for PGRES_FATAL_ERROR result */
+    if (self->pgres == NULL) {
+        pgconn_set_critical(self);
+        return pgconn_resolve_critical(self);
+    }
+
+    /* now we set the status to LOCKED, to avoid unwanted commits or rollbacks
+       from other threads. if another thread expect to sync *everything* with
+       a single call to .commit() on the connection, it better has to sync
+       with us. because us and him are about to work on the same keeper,
+       setting status to LOCKED is like shifting *our* execution time a little
+       bit in the future... */
+    pthread_mutex_lock(&(self->keeper->lock));
+    old_keeper_status = self->keeper->status;
+    self->keeper->status = KEEPER_LOCKED;
+    pthread_mutex_unlock(&(self->keeper->lock));
+    
+    pgstatus = PQresultStatus(self->pgres);
+    
+    switch(pgstatus) {
+
+        /* send data to the backend */
+    case PGRES_COPY_OUT:
+        Dprintf("_psyco_curs_result: command returned COPY_OUT\n");
+        /* fall through to the COPY_IN */
+
+        /* data from the backend */
+    case PGRES_COPY_IN:
+        Dprintf("_psyco_curs_result: command returned COPY_IN\n");
+        
+        /* call the callback */
+        if (cb && cb_args) {
+            res = cb(self, cb_args);
+            if (PyErr_Occurred()) {
+                Py_XDECREF(res);
+                goto error;
+            }
+        }
+        else {
+            PyErr_SetString(ProgrammingError,
+                            "COPY TO/COPY FROM can't be used in .execute()");
+            goto error;
+        }
+        break;
+
+        /* tuples, this was a select */
+    case PGRES_TUPLES_OK:
+        self->rowcount = self->ntuples = PQntuples(self->pgres);
+        Dprintf("_psyco_curs_result: got %ld tuples\n", self->rowcount);
+        _psyco_curs_describe(self);
+        break;
 
         /* ok but no tuples */
     case PGRES_COMMAND_OK:
-        Dprintf("_psyco_curs_execute: command returned OK (no tuples)\n");
+        Dprintf("_psyco_curs_result: command returned OK (no tuples)\n");
         /* sets rowcount to the right number of affected tuples */
         self->rowcount = atol(PQcmdTuples(self->pgres));
         /* try to obtain the oid of an insert */
@@ -941,64 +1515,268 @@ _psyco_curs_execute(cursobject *self, char *query,
         break;
     
         /* error! error! */
-    default: {
-        char *pgerr = PQresultErrorMessage(self->pgres);
-        char *errstr = NULL;
+    default:
+        pgres_set_error(self->pgres, query);
+        CLEARPGRES(self->pgres);
+        goto error;
+    }
 
-        if (asprintf(&errstr, "%s\n%s", pgerr, query) >= 0) {
-#if POSTGRESQL_MAJOR >= 8 || POSTGRESQL_MINOR >= 4
-            char *pgstate = PQresultErrorField(self->pgres, PG_DIAG_SQLSTATE);
-
-            /* if pgstate is NULL we are using a new libpq to connect to an
-               old backend; need to account for it to avoid cirillic :)
-               segmentation faults... */
-            if ((pgstate && !strncmp(pgstate, "23", 2))
-                || (!pgstate &&
-                 (!strncmp(pgerr, "ERROR:  Cannot insert a duplicate key", 37)
-                  || !strncmp(pgerr, "ERROR:  ExecAppend: Fail to add null",36)
-                  || strstr(pgerr, "referential integrity violation"))))
-#else       
-            if (!strncmp(pgerr, "ERROR:  Cannot insert a duplicate key", 37)
-                || !strncmp(pgerr, "ERROR:  ExecAppend: Fail to add null", 36)
-                || strstr(pgerr, "referential integrity violation"))
-#endif	
-                PyErr_SetString(IntegrityError, errstr);
-            else
-                PyErr_SetString(ProgrammingError, errstr);
-            free(errstr);
+    /* check for result (should be at least None) */
+    if (res == NULL) {
+        Py_INCREF(Py_None);
+        res = Py_None;
+    }
+    
+    /* here we replace status with its default value */
+    pthread_mutex_lock(&(self->keeper->lock));
+    self->keeper->status = old_keeper_status;
+    pthread_mutex_unlock(&(self->keeper->lock));
+    return res;
+    
+  error:
+    Dprintf("_psyco_curs_result: error, NOT resetting connection\n");
+    pthread_mutex_lock(&(self->keeper->lock));
+    self->keeper->status = old_keeper_status;
+    pthread_mutex_unlock(&(self->keeper->lock));
+    EXC_IFCRITICAL(self);
+    return NULL;
+}
+
+
+/* _psyco_curs_fetch_batch() - fetch the next batch of rows of a named cursor
+ *
+ * the batch is read from the backend with FETCH FORWARD arraysize; if the
+ * batch is full we immediately send the next FETCH so that the backend works
+ * on it while the user is still processing the current rows. returns -1 on
+ * error and the number of fetched rows otherwise.
+ *
+ * this function locks the keeper
+ * this function enters an ALLOW_THREADS wrapper
+ */
+static int
+_psyco_curs_fetch_batch(cursobject *self)
+{
+    char *query = NULL;
+    PGresult *pgres = NULL;
+    long int size = self->arraysize > 0 ? self->arraysize : 1;
+    int prefetched;
+    double start = 0.0, locked = 0.0, executed = 0.0;
+    int instrument = self->conn->instrument;
+
+    if (asprintf(&query, "FETCH FORWARD %ld FROM %s", size, self->name) < 0) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    Dprintf("_psyco_curs_fetch_batch: query = %s, prefetched = %d\n",
+            query, self->prefetch);
+
+    if (instrument) start = psyco_gettime();
+    pthread_mutex_lock(&(self->keeper->lock));
+    Py_BEGIN_ALLOW_THREADS;
+    if (instrument) locked = psyco_gettime();
+    prefetched = self->prefetch;
+    if (prefetched) {
+        pgres = PQgetResult(self->pgconn);
+        _psyco_curs_drain(self);
+    }
+    else {
+        pgres = PQexec(self->pgconn, query);
+    }
+    if (instrument) executed = psyco_gettime();
+    pthread_mutex_unlock(&(self->keeper->lock));
+    Py_END_ALLOW_THREADS;
+
+    if (instrument) {
+        STATS_ADD(self, lockwait, locked - start);
+        STATS_ADD(self, exectime, executed - locked);
+    }
+
+    IFCLEARPGRES(self->pgres);
+    self->pgres = pgres;
+    self->row = 0;
+    self->ntuples = 0;
+
+    if (self->pgres == NULL) {
+        free(query);
+        pgconn_set_critical(self);
+        pgconn_resolve_critical(self);
+        return -1;
+    }
+    if (PQresultStatus(self->pgres) != PGRES_TUPLES_OK) {
+        PyErr_SetString(ProgrammingError,
+                        PQresultErrorMessage(self->pgres));
+        CLEARPGRES(self->pgres);
+        free(query);
+        return -1;
+    }
+
+    self->ntuples = PQntuples(self->pgres);
+    self->pos += self->ntuples;
+    Dprintf("_psyco_curs_fetch_batch: got %ld tuples, pos = %ld\n",
+            self->ntuples, self->pos);
+
+    /* the first batch gives us the description of the result */
+    if (self->notuples) _psyco_curs_describe(self);
+
+    /* a full batch means there are (probably) more rows: ask for them now */
+    if (self->ntuples == size) {
+        pthread_mutex_lock(&(self->keeper->lock));
+        Py_BEGIN_ALLOW_THREADS;
+        self->prefetch = PQsendQuery(self->pgconn, query);
+        pthread_mutex_unlock(&(self->keeper->lock));
+        Py_END_ALLOW_THREADS;
+    }
+
+    free(query);
+    return (int)self->ntuples;
+}
+
+/* _psyco_curs_keyword() - index of the word at c in keywords, -1 if none */
+static int
+_psyco_curs_keyword(const char *c, int len, const char **keywords)
+{
+    int i, j;
+
+    for (i = 0; keywords[i] != NULL; i++) {
+        if (len != (int)strlen(keywords[i])) continue;
+        for (j = 0; j < len; j++) {
+            if (tolower((unsigned char)c[j]) != keywords[i][j]) break;
+        }
+        if (j == len) return i;
+    }
+    return -1;
+}
+
+/* _psyco_curs_returns_rows() - true if query can be used in a DECLARE
+ *
+ * the first keyword of the query, after any whitespace, comment and opening
+ * parenthesis, must be SELECT, VALUES, WITH or TABLE. the backend refuses
+ * to DECLARE data-modifying WITH queries, SELECT ... INTO and (on a SCROLL
+ * or WITH HOLD cursor) SELECT ... FOR UPDATE/SHARE, so the rest of the query
+ * is scanned for those keywords, skipping literals, quoted identifiers and
+ * comments. a false positive (a column called "share", say) only makes the
+ * query run as on a normal cursor.
+ */
+static int
+_psyco_curs_returns_rows(const char *query)
+{
+    static const char *first[] = {"select", "values", "with", "table", NULL};
+    static const char *refused[] = {"insert", "update", "delete", "merge",
+                                    "into", "share", NULL};
+    const char *c = query, *tag;
+    int len, taglen, depth, words = 0;
+
+    while (*c) {
+        if (isspace((unsigned char)*c) || *c == '(' || *c == ')') {
+            c++;
+        }
+        else if (c[0] == '-' && c[1] == '-') {
+            while (*c && *c != '\n') c++;
+        }
+        else if (c[0] == '/' && c[1] == '*') {
+            /* comments nest in PostgreSQL */
+            for (c += 2, depth = 1; *c && depth > 0; c++) {
+                if (c[0] == '/' && c[1] == '*') depth++, c++;
+                else if (c[0] == '*' && c[1] == '/') depth--, c++;
+            }
+        }
+        else if (*c == '\'') {
+            /* quotes are doubled or backslash-escaped */
+            for (c++; *c; c++) {
+                if (*c == '\\' && c[1]) c++;
+                else if (c[0] == '\'' && c[1] == '\'') c++;
+                else if (*c == '\'') break;
+            }
+            if (*c) c++;
+        }
+        else if (*c == '"') {
+            for (c++; *c; c++) {
+                if (c[0] == '"' && c[1] == '"') c++;
+                else if (*c == '"') break;
+            }
+            if (*c) c++;
+        }
+        else if (*c == '$' && !isdigit((unsigned char)c[1])) {
+            /* $tag$ ... $tag$, a lone $ is just skipped */
+            for (tag = c++; isalnum((unsigned char)*c) || *c == '_'; c++);
+            if (*c != '$') continue;
+            taglen = ++c - tag;
+            while (*c && strncmp(c, tag, taglen) != 0) c++;
+            if (*c) c += taglen;
+        }
+        else if (isalpha((unsigned char)*c) || *c == '_') {
+            for (len = 0; isalnum((unsigned char)c[len]) || c[len] == '_'
+                     || c[len] == '$'; len++);
+            if (words++ == 0) {
+                if (_psyco_curs_keyword(c, len, first) < 0) return 0;
+            }
+            else if (_psyco_curs_keyword(c, len, refused) >= 0) {
+                Dprintf("_psyco_curs_returns_rows: found %.*s\n", len, c);
+                return 0;
+            }
+            c += len;
         }
         else {
-            PyErr_SetString(ProgrammingError, pgerr);
+            /* numbers, operators, parameters... */
+            if (words == 0) return 0;
+            c++;
         }
-        Dprintf("_psyco_curs_execute: error: pgerr = %s\n", pgerr);
+    }
+    return words > 0;
+}
+
+/* _psyco_curs_declare() - execute a query using a server-side cursor
+ *
+ * the query is wrapped in a DECLARE SCROLL, so that scroll() can MOVE
+ * backward whatever the plan is; outside of a transaction (autocommit) the
+ * cursor is declared WITH HOLD to let it survive the implicit commit.
+ * the first batch of rows is fetched immediately to build the description.
+ * DECLARE can't be prepared, so params (if any) are always sent with
+ * PQexecParams(). statements not returning rows (INSERT, UPDATE, DDL...)
+ * can't be DECLAREd and are executed as by a normal cursor.
+ */
+static PyObject *
+_psyco_curs_declare(cursobject *self, char *query, _psyco_curs_params *params)
+{
+    char *declare = NULL;
+    PyObject *res;
+    int withhold;
 
-        CLEARPGRES(self->pgres);
-        goto error;
-    }
-        break;
+    /* drop the result of the previous execute() */
+    _psyco_curs_close_named(self);
+
+    if (!_psyco_curs_returns_rows(query)) {
+        Dprintf("_psyco_curs_declare: not a query, executing it normally\n");
+        return _psyco_curs_execute(self, query, params, NULL, NULL);
     }
 
-    /* check for result (should be at least None) */
-    if (res == NULL) {
-        Py_INCREF(Py_None);
-        res = Py_None;
+    withhold = (self->isolation_level == 0);
+    if (asprintf(&declare, "DECLARE %s SCROLL CURSOR %sFOR %s", self->name,
+                 withhold ? "WITH HOLD " : "", query) < 0) {
+        return PyErr_NoMemory();
     }
-    
-    /* here we replace status with its default value */
-    pthread_mutex_lock(&(self->keeper->lock));
-    self->keeper->status = old_keeper_status;
-    pthread_mutex_unlock(&(self->keeper->lock));
-    return res;
-    
-  error:
-    Dprintf("_psyco_curs_execute: error, NOT resetting connection\n");
-    pthread_mutex_lock(&(self->keeper->lock));
-    self->keeper->status = old_keeper_status;
-    pthread_mutex_unlock(&(self->keeper->lock));
-    EXC_IFCRITICAL(self);
-    return NULL;    
+
+    if (params) params->operation = NULL;
+    res = _psyco_curs_execute(self, declare, params, NULL, NULL);
+    free(declare);
+    if (res == NULL) return NULL;
+    Py_DECREF(res);
+
+    self->serverside = 1;
+    self->declared = 1;
+    self->withhold = withhold;
+    self->pos = 0;
+
+    if (_psyco_curs_fetch_batch(self) < 0) return NULL;
+
+    /* we don't know how many rows the query will return */
+    self->rowcount = -1;
+
+    Py_INCREF(Py_None);
+    return Py_None;
 }
 
+
 static int
 _mogrify(PyObject *var, PyObject *fmt, PyObject **new)
 {
@@ -1121,123 +1899,597 @@ _mogrify(PyObject *var, PyObject *fmt, PyObject **new)
                 /* here we steal value ref, no need to DECREF */
             }
 
-            c = d;
-            index += 1;
-        }
-        else {
-            c++;
-        }
+            c = d;
+            index += 1;
+        }
+        else {
+            c++;
+        }
+    }
+
+    if (force && n == NULL)
+        n = PyTuple_New(0);
+    *new = n;
+    
+    return 0;
+}
+
+#if POSTGRESQL_MAJOR >= 8
+/* _psyco_curs_parse() - convert a pyformat operation to $n placeholders
+ *
+ * %s and %(name)s placeholders are replaced by $1, $2, ... (the same name
+ * always gets the same number) and %% by a single %. the parameter names,
+ * in order, are stored in keys (NULL for positional placeholders.) returns 1
+ * if the operation can't be sent with out-of-band parameters (other
+ * conversions or mixed placeholder styles), -1 on memory errors and 0 if
+ * successful.
+ */
+static int
+_psyco_curs_parse(char *operation, char **query, int *nparams, char ***keys)
+{
+    char *c, *d, *q, **k = NULL;
+    int i, l, n = 0, named = -1, retvalue = 1, len = strlen(operation);
+
+    /* every placeholder is at least two characters long and can grow to a
+       '$' followed by the digits of its number */
+    for (c = operation, l = len + 1; (c = strchr(c, '%')); c++) l += 12;
+    if (!(*query = q = (char *)malloc(l))) return -1;
+
+    for (c = operation; *c; ) {
+        if (c[0] != '%') {
+            *q++ = *c++;
+        }
+        else if (c[1] == '%') {
+            *q++ = '%';
+            c += 2;
+        }
+        else if (c[1] == '(' && named != 0) {
+            for (d = c + 2; *d && *d != ')'; d++);
+            if (*d != ')' || d[1] != 's') goto cleanup;
+            l = d - c - 2;
+
+            if (k == NULL) {
+                named = 1;
+                if (!(k = (char **)calloc(len/4 + 1, sizeof(char *))))
+                    goto nomem;
+            }
+            for (i = 0; i < n; i++)
+                if (!strncmp(k[i], c + 2, l) && k[i][l] == '\0') break;
+            if (i == n) {
+                if (!(k[n] = (char *)malloc(l + 1))) goto nomem;
+                memcpy(k[n], c + 2, l);
+                k[n++][l] = '\0';
+            }
+            q += sprintf(q, "$%d", i + 1);
+            c = d + 2;
+        }
+        else if (c[1] == 's' && named != 1) {
+            named = 0;
+            q += sprintf(q, "$%d", ++n);
+            c += 2;
+        }
+        else {
+            goto cleanup;
+        }
+    }
+    *q = '\0';
+
+    Dprintf("_psyco_curs_parse: query = >%s<, nparams = %d\n", *query, n);
+    *nparams = n;
+    *keys = k;
+    return 0;
+
+  nomem:
+    retvalue = -1;
+  cleanup:
+    if (k) {
+        for (i = 0; i < n; i++) free(k[i]);
+        free(k);
+    }
+    free(*query);
+    *query = NULL;
+    return retvalue;
+}
+
+/* _psyco_curs_bind() - convert the parameters to the strings sent to libpq
+ *
+ * None is sent as NULL, strings as they are, numbers and psycopg dates and
+ * times using their string representation (without quotes.) the strings are
+ * kept alive by the tuple returned in strs. returns 1 if a value can't be
+ * sent out-of-band (Binary, QuotedString, unicode, sequences, ...) or the
+ * number of values is wrong, -1 if python raised an exception and 0 if
+ * successful.
+ */
+static int
+_psyco_curs_bind(PyObject *vars, int nparams, char **keys,
+                 PyObject **strs, const char **values)
+{
+    PyObject *value, *str, *tmp;
+    int i;
+
+    if (keys == NULL && (!(PyTuple_Check(vars) || PyList_Check(vars))
+                         || PySequence_Size(vars) != nparams))
+        return 1;
+    
+    if (!(*strs = PyTuple_New(nparams))) return -1;
+
+    for (i = 0; i < nparams; i++) {
+        if (keys)
+            value = PyMapping_GetItemString(vars, keys[i]);
+        else
+            value = PySequence_GetItem(vars, i);
+        if (value == NULL) return -1;
+
+        if (value == Py_None) {
+            str = value;
+        }
+        else if (PyString_Check(value)) {
+            str = value;
+        }
+        else if (PyInt_Check(value) || PyLong_Check(value)
+                 || PyFloat_Check(value)) {
+            str = PyObject_Str(value);
+            Py_DECREF(value);
+        }
+        else if (PyObject_TypeCheck(value, &psyco_DateTimeObject_Type)) {
+            /* strip the quotes added for client-side interpolation */
+            tmp = PyObject_Str(value);
+            Py_DECREF(value);
+            if (tmp == NULL) return -1;
+            str = PyString_FromStringAndSize(PyString_AS_STRING(tmp) + 1,
+                                             PyString_GET_SIZE(tmp) - 2);
+            Py_DECREF(tmp);
+        }
+        else {
+            Py_DECREF(value);
+            return 1;
+        }
+        if (str == NULL) return -1;
+
+        PyTuple_SET_ITEM(*strs, i, str);
+        values[i] = (str == Py_None) ? NULL : PyString_AS_STRING(str);
+    }
+    return 0;
+}
+
+/* _psyco_curs_execute_params() - execute with out-of-band parameters
+ *
+ * the parameters are not interpolated in the query but sent to the backend
+ * separately; if prepare is true the statement is executed through the
+ * keeper's statement cache. if the operation or the parameters can't be sent
+ * that way, fallback is set to 1 and the caller should mogrify the query as
+ * usual.
+ */
+static PyObject *
+_psyco_curs_execute_params(cursobject *self, PyObject *operation,
+                           PyObject *vars, int prepare, int *fallback)
+{
+    _psyco_curs_params params;
+    PyObject *strs = NULL, *res = NULL;
+    char *query = NULL, **keys = NULL;
+    int i, r, nparams = 0;
+
+    *fallback = 0;
+
+    /* without parameters the operation is used verbatim, like execute()
+       always did */
+    if (vars) {
+        r = _psyco_curs_parse(PyString_AS_STRING(operation),
+                              &query, &nparams, &keys);
+    }
+    else {
+        r = (query = strdup(PyString_AS_STRING(operation))) ? 0 : -1;
+    }
+    if (r == -1) return PyErr_NoMemory();
+    if (r == 1) {
+        *fallback = 1;
+        return NULL;
+    }
+
+    params.operation = prepare ? PyString_AS_STRING(operation) : NULL;
+    params.batch = NULL;
+    params.hash = PyObject_Hash(operation);
+    params.nparams = nparams;
+    params.values = (const char **)calloc(nparams + 1, sizeof(char *));
+    if (params.values == NULL) {
+        PyErr_NoMemory();
+        goto cleanup;
+    }
+    
+    if (vars) {
+        r = _psyco_curs_bind(vars, nparams, keys, &strs, params.values);
+        if (r != 0) {
+            *fallback = (r == 1);
+            goto cleanup;
+        }
+    }
+
+    if (self->name)
+        res = _psyco_curs_declare(self, query, &params);
+    else
+        res = _psyco_curs_execute(self, query, &params, NULL, NULL);
+
+  cleanup:
+    Py_XDECREF(strs);
+    if (params.values) free(params.values);
+    if (keys) {
+        for (i = 0; i < nparams; i++) free(keys[i]);
+        free(keys);
+    }
+    free(query);
+    return res;
+}
+#endif
+
+/* _psyco_curs_format() - mogrify operation and params into a query string
+ *
+ * returns a new string that should be freed by the caller or NULL if an
+ * exception was raised.
+ */
+static char *
+_psyco_curs_format(PyObject *operation, PyObject *d)
+{
+    PyObject *cvt = NULL, *pystr = NULL;
+    char *query = NULL;
+
+    /* we got a dictionary of values to substitute in the query string, we do
+       that by first mogrifying the format string and the dict/tuple, then
+       using standard python methods */
+    if (d)
+    {
+        if (_mogrify(d, operation, &cvt) == -1) return NULL;
+    }
+
+    if (d && cvt) {
+        /* if PyString_Format() return NULL an error occured: if the error
+           is a TypeError we need to check the exception.args[0] string for
+           the values:
+           
+               "not enough arguments for format string"
+               "not all arguments converted"
+
+           and return the appropriate ProgrammingError. we do that by
+           grabbing the curren exception (we will later restore it if the
+           type or the strings do not match). */
+        if (cvt != NULL && !(pystr = PyString_Format(operation, cvt))) {
+            PyObject *err, *arg, *trace;
+            int pe = 0;
+
+            Dprintf("_psyco_curs_format: PyString_Format() error\n");
+            
+            PyErr_Fetch(&err, &arg, &trace);
+            
+            if (err && PyErr_GivenExceptionMatches(err, PyExc_TypeError)) {
+                Dprintf("_psyco_curs_format: TypeError exception catched\n");
+                
+                PyErr_NormalizeException(&err, &arg, &trace);
+                Dprintf("_psyco_curs_format: exception normalized\n");
+                
+                if (PyObject_HasAttrString(arg, "args")) {
+                    PyObject *args = PyObject_GetAttrString(arg, "args");
+                    PyObject *str = PySequence_GetItem(args, 0);
+                    char *s = PyString_AS_STRING(str);
+
+                    Dprintf("_psyco_curs_format: s = %s\n", s);
+
+                    if (!strcmp(s, "not enough arguments for format string")
+                      || !strcmp(s, "not all arguments converted")) {
+                        Dprintf("_psyco_curs_format: exception matches\n");
+                        PyErr_SetString(ProgrammingError, s);
+                        pe = 1;
+                        Dprintf("_psyco_curs_format: new exception set\n");
+                    }
+
+                    Py_DECREF(args);
+                    Py_DECREF(str);
+                    Dprintf("_psyco_curs_format: arguments destroyed\n");
+                }
+            }
+
+            /* if we did not manage our own exception, restore old one */
+            if (pe == 1) {
+                Py_XDECREF(err); Py_XDECREF(arg); Py_XDECREF(trace);
+            }
+            else {
+                PyErr_Restore(err, arg, trace);
+            }
+            return NULL;
+        }
+        query = strdup(PyString_AsString(pystr));
+
+        Dprintf("_psyco_curs_format: cvt->refcnt = %d\n", cvt->ob_refcnt);
+        
+        Py_DECREF(pystr);
+        Py_DECREF(cvt);
+    }
+    else {
+        query = strdup(PyString_AsString(operation));
+    }
+
+    Dprintf("_psyco_curs_format: operation->refcnt = %d\n",
+            operation->ob_refcnt);
+
+    if (query == NULL) PyErr_NoMemory();
+    return query;
+}
+
+static PyObject *
+_psyco_curs_execute_operation(cursobject *self, PyObject *operation,
+                              PyObject *d, PyObject *prepare)
+{
+    PyObject *res;
+    char *query = NULL;
+
+    EXC_IFCLOSED(self);
+    IFCLEARPGRES(self->pgres);
+
+    Dprintf("psyco_curs_execute: operation = >%s<\n",
+            PyString_AsString(operation));
+
+#if POSTGRESQL_MAJOR >= 8
+    if (prepare && prepare != Py_None) {
+        int fallback, doprepare;
+
+        if ((doprepare = PyObject_IsTrue(prepare)) < 0) return NULL;
+        res = _psyco_curs_execute_params(self, operation, d, doprepare,
+                                         &fallback);
+        if (!fallback) return res;
+        Dprintf("psyco_curs_execute: can't send parameters out-of-band\n");
+    }
+#endif
+
+    if (!(query = _psyco_curs_format(operation, d))) return NULL;
+
+    if (self->name)
+        res = _psyco_curs_declare(self, query, NULL);
+    else
+        res = _psyco_curs_execute(self, query, NULL, NULL, NULL);
+    free(query);
+    return res;
+}
+
+/* psyco_curs_execute() - prepare and execute a database query */
+
+static char psyco_curs_execute__doc__[] = 
+"Prepare and execute a database operation (query or command.)\n"
+"If prepare is given the parameters are sent to the backend separately\n"
+"instead of being quoted into the query; if prepare is true the statement\n"
+"is also prepared once per connection and reused by later executions of\n"
+"the same operation. If the prepared statement was deallocated by someone\n"
+"else (DEALLOCATE ALL, DISCARD ALL) it is prepared again in autocommit\n"
+"mode; inside a transaction, that the backend aborted, OperationalError\n"
+"is raised: rollback and execute again.";
+
+static PyObject *
+psyco_curs_execute(cursobject *self, PyObject *args, PyObject *kwords)
+{
+    PyObject *operation = NULL, *d = NULL, *prepare = NULL;
+    static char *kwlist[] = {"operation", "params", "prepare", NULL};
+    
+    if (!PyArg_ParseTupleAndKeywords(args, kwords, "O!|OO", kwlist,
+                                     &PyString_Type, &operation, &d,
+                                     &prepare)) {
+        return NULL;
+    }
+    return _psyco_curs_execute_operation(self, operation, d, prepare);
+}
+
+
+/**** ASYNCHRONOUS QUERIES ****/
+
+/* psyco_curs_execute_async() - send a query without waiting for the result */
+
+static char psyco_curs_execute_async__doc__[] =
+"Send a database operation to the backend and return without waiting for\n"
+"the result. Use .fileno() to wait for the socket to become readable and\n"
+".poll() to collect the result; nothing else can be executed on the\n"
+"connection until .poll() returns true.";
+
+static PyObject *
+psyco_curs_execute_async(cursobject *self, PyObject *args)
+{
+    PyObject *operation = NULL, *d = NULL;
+    char *query;
+    int sent;
+
+    if (!PyArg_ParseTuple(args, "O!|O", &PyString_Type, &operation, &d)) {
+        return NULL;
+    }
+
+    EXC_IFCLOSED(self);
+    if (self->name) {
+        PyErr_SetString(NotSupportedError,
+                        "named cursors can't execute asynchronous queries");
+        return NULL;
+    }
+    EXC_IFASYNC(self);
+
+    psyco_curs_reset(self, 0);
+    EXC_IFCRITICAL(self);
+
+    assert(self->pgconn);
+    if (PQstatus(self->pgconn) != CONNECTION_OK) {
+        Dprintf("psyco_curs_execute_async: connection NOT OK\n");
+        PyErr_SetString(OperationalError, PQerrorMessage(self->pgconn));
+        return NULL;
+    }
+
+    if (!(query = _psyco_curs_format(operation, d))) return NULL;
+
+    pthread_mutex_lock(&(self->keeper->lock));
+    Py_BEGIN_ALLOW_THREADS;
+    Dprintf("psyco_curs_execute_async: query = >%s<\n", query);
+    _psyco_curs_drain(self);
+    begin_pgconn(self);
+    IFCLEARPGRES(self->pgres);
+    sent = PQsendQuery(self->pgconn, query);
+    if (sent) self->keeper->async = self;
+    pthread_mutex_unlock(&(self->keeper->lock));
+    Py_END_ALLOW_THREADS;
+
+    if (!sent) {
+        Dprintf("psyco_curs_execute_async: PQsendQuery failed\n");
+        PyErr_SetString(OperationalError, PQerrorMessage(self->pgconn));
+        free(query);
+        return NULL;
+    }
+
+    if (self->asyncquery) free(self->asyncquery);
+    self->asyncquery = query;
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+
+/* _psyco_curs_async_check() - make sure an asynchronous query is pending
+ *
+ * returns 0 if the query sent by .execute_async() is still ours to collect;
+ * otherwise sets an exception and returns -1.
+ */
+static int
+_psyco_curs_async_check(cursobject *self)
+{
+    if (self->asyncquery == NULL) {
+        PyErr_SetString(ProgrammingError, "no asynchronous query in progress");
+        return -1;
     }
 
-    if (force && n == NULL)
-        n = PyTuple_New(0);
-    *new = n;
-    
+    /* someone discarded the result (a commit, a rollback or another query
+       executed by this same cursor) */
+    if (self->keeper->async != self) {
+        free(self->asyncquery);
+        self->asyncquery = NULL;
+        PyErr_SetString(OperationalError,
+                        "asynchronous query interrupted by another command");
+        return -1;
+    }
     return 0;
 }
 
-/* psyco_curs_execute() - prepare and execute a database query */
 
-static char psyco_curs_execute__doc__[] = 
-"Prepare and execute a database operation (query or command.)";
+/* psyco_curs_isready() - check (without blocking) if the result arrived */
+
+static char psyco_curs_isready__doc__[] =
+"Read any data available on the socket and return true if the result of\n"
+"the query sent by .execute_async() can be collected without blocking.";
 
 static PyObject *
-psyco_curs_execute(cursobject *self, PyObject *args)
+psyco_curs_isready(cursobject *self, PyObject *args)
 {
-    PyObject *d = NULL, *cvt = NULL, *operation = NULL, *pystr = NULL, *res;
-    char *query = NULL;
-    
-    if (!PyArg_ParseTuple(args, "O!|O",
-                          &PyString_Type, &operation, &d)) {
-        return NULL;
-    }
+    int ready = -1;
 
+    PARSEARGS(args);
     EXC_IFCLOSED(self);
-    IFCLEARPGRES(self->pgres);
+    if (_psyco_curs_async_check(self) < 0) return NULL;
 
-    Dprintf("psyco_curs_execute: operation = >%s<\n",
-            PyString_AsString(operation));
+    pthread_mutex_lock(&(self->keeper->lock));
+    if (PQconsumeInput(self->pgconn)) ready = !PQisBusy(self->pgconn);
+    pthread_mutex_unlock(&(self->keeper->lock));
 
-    /* we got a dictionary of values to substitute in the query string, we do
-       that by first mogrifying the format string and the dict/tuple, then
-       using standard python methods */
-    if (d)
-    {
-        if (_mogrify(d, operation, &cvt) == -1) return NULL;
+    if (ready < 0) {
+        PyErr_SetString(OperationalError, PQerrorMessage(self->pgconn));
+        return NULL;
     }
+    return PyInt_FromLong((long)ready);
+}
 
-    if (d && cvt) {
-        /* if PyString_Format() return NULL an error occured: if the error
-           is a TypeError we need to check the exception.args[0] string for
-           the values:
-           
-               "not enough arguments for format string"
-               "not all arguments converted"
-
-           and return the appropriate ProgrammingError. we do that by
-           grabbing the curren exception (we will later restore it if the
-           type or the strings do not match). */
-        if (cvt != NULL && !(pystr = PyString_Format(operation, cvt))) {
-            PyObject *err, *arg, *trace;
-            int pe = 0;
 
-            Dprintf("psyco_curs_execute: PyString_Format() error\n");
-            
-            PyErr_Fetch(&err, &arg, &trace);
-            
-            if (err && PyErr_GivenExceptionMatches(err, PyExc_TypeError)) {
-                Dprintf("psyco_curs_execute: TypeError exception catched\n");
-                
-                PyErr_NormalizeException(&err, &arg, &trace);
-                Dprintf("psyco_curs_execute: exception normalized\n");
-                
-                if (PyObject_HasAttrString(arg, "args")) {
-                    PyObject *args = PyObject_GetAttrString(arg, "args");
-                    PyObject *str = PySequence_GetItem(args, 0);
-                    char *s = PyString_AS_STRING(str);
+/* psyco_curs_poll() - collect the result of an asynchronous query
+ *
+ * all the results of the query are read from the connection: the first
+ * error (if any) or the last result is kept in self->pgres and then parsed
+ * by _psyco_curs_result() exactly as a synchronous .execute() does.
+ *
+ * this function locks the keeper
+ * this function enters an ALLOW_THREADS wrapper
+ */
 
-                    Dprintf("psyco_curs_execute: s = %s\n", s);
+static char psyco_curs_poll__doc__[] =
+"Collect the result of the query sent by .execute_async(). Returns false\n"
+"if the backend is still working (wait on .fileno() and call it again)\n"
+"and true once the result is available to the fetch*() methods.";
 
-                    if (!strcmp(s, "not enough arguments for format string")
-                      || !strcmp(s, "not all arguments converted")) {
-                        Dprintf("psyco_curs_execute: exception matches\n");
-                        PyErr_SetString(ProgrammingError, s);
-                        pe = 1;
-                        Dprintf("psyco_curs_execute: new exception set\n");
-                    }
+static PyObject *
+psyco_curs_poll(cursobject *self, PyObject *args)
+{
+    PGresult *pgres;
+    PyObject *res;
+    int busy = 0, failed = 0;
+#if POSTGRESQL_MAJOR >= 8
+    int pgstatus;
+    char *buf;
+#endif
 
-                    Py_DECREF(args);
-                    Py_DECREF(str);
-                    Dprintf("psyco_curs_execute: arguments destroyed\n");
-                }
-            }
+    PARSEARGS(args);
+    EXC_IFCLOSED(self);
+    if (_psyco_curs_async_check(self) < 0) return NULL;
 
-            /* if we did not manage our own exception, restore old one */
-            if (pe == 1) {
-                Py_XDECREF(err); Py_XDECREF(arg); Py_XDECREF(trace);
-            }
-            else {
-                PyErr_Restore(err, arg, trace);
-            }
-            return NULL;
+    pthread_mutex_lock(&(self->keeper->lock));
+    Py_BEGIN_ALLOW_THREADS;
+    while (1) {
+        if (!PQconsumeInput(self->pgconn)) {
+            failed = 1;
+            break;
         }
-        query = strdup(PyString_AsString(pystr));
+        if (PQisBusy(self->pgconn)) {
+            busy = 1;
+            break;
+        }
+        if ((pgres = PQgetResult(self->pgconn)) == NULL) break;
+
+        /* COPY is not supported here: get the connection out of it and
+           keep the result, so that _psyco_curs_result() raises */
+#if POSTGRESQL_MAJOR >= 8
+        pgstatus = PQresultStatus(pgres);
+        if (pgstatus == PGRES_COPY_IN) {
+            PQputCopyEnd(self->pgconn, "COPY is not supported by poll()");
+        }
+        else if (pgstatus == PGRES_COPY_OUT) {
+            while (PQgetCopyData(self->pgconn, &buf, 0) > 0) PQfreemem(buf);
+        }
+#endif
+        Dprintf("psyco_curs_poll: got result with status %d\n",
+                PQresultStatus(pgres));
+
+        /* a multi-statement query stops at the first error */
+        if (self->pgres == NULL
+            || (PQresultStatus(self->pgres) != PGRES_FATAL_ERROR
+                && PQresultStatus(self->pgres) != PGRES_COPY_IN
+                && PQresultStatus(self->pgres) != PGRES_COPY_OUT)) {
+            IFCLEARPGRES(self->pgres);
+            self->pgres = pgres;
+        }
+        else {
+            PQclear(pgres);
+        }
+    }
+    if (!busy) self->keeper->async = NULL;
+    pthread_mutex_unlock(&(self->keeper->lock));
+    Py_END_ALLOW_THREADS;
 
-        Dprintf("psyco_curs_execute: cvt->refcnt = %d\n", cvt->ob_refcnt);
-        
-        Py_DECREF(pystr);
-        Py_DECREF(cvt);
+    if (busy) {
+        Dprintf("psyco_curs_poll: backend still busy\n");
+        return PyInt_FromLong(0L);
+    }
+
+    if (failed) {
+        PyErr_SetString(OperationalError, PQerrorMessage(self->pgconn));
+        IFCLEARPGRES(self->pgres);
+        res = NULL;
     }
     else {
-        query = strdup(PyString_AsString(operation));
+        res = _psyco_curs_result(self, self->asyncquery, NULL, NULL);
+        if (self->conn->instrument && res)
+            _psyco_curs_account(self, self->asyncquery);
     }
 
-    Dprintf("psyco_curs_execute: operation->refcnt = %d\n",
-            operation->ob_refcnt);
+    free(self->asyncquery);
+    self->asyncquery = NULL;
 
-    res = _psyco_curs_execute(self, query, NULL, NULL);
-    free(query);
-    return res;
+    if (res == NULL) return NULL;
+    Py_DECREF(res);
+    return PyInt_FromLong(1L);
 }
 
 
@@ -1335,7 +2587,7 @@ psyco_curs_callproc(cursobject *self, PyObject *args)
     }
 
 
-    _psyco_curs_execute(self, query, NULL, NULL);
+    _psyco_curs_execute(self, query, NULL, NULL, NULL);
     free(query);
     return seq;
 }
@@ -1345,127 +2597,379 @@ psyco_curs_callproc(cursobject *self, PyObject *args)
 static char psyco_curs_executemany__doc__[] = 
 "Prepare a database operation (query or command) and then execute it "
 "against all parameter sequences or mappings found in the sequence "
-"seq_of_parameters.";
+"seq_of_parameters. The prepare argument is passed to execute().\n"
+"Inside a transaction the statements are sent to the backend in batches;\n"
+"in autocommit mode they are executed (and committed) one at a time.";
+
+/* _psyco_curs_executebatch() - execute operation BATCHSIZE rows at a time
+ *
+ * the queries for up to BATCHSIZE parameter sets are joined in a single
+ * multi-statement string and sent with a single round trip to the backend.
+ * the statements are separated by "\n;" so that a trailing -- comment can't
+ * swallow the following ones. the backend executes a batch as a single
+ * implicit transaction, so executemany() only uses this function inside
+ * transactions, where an error aborts all the previous statements anyway.
+ */
+static int
+_psyco_curs_executebatch(cursobject *self, PyObject *operation,
+                         PyObject *parm_seq)
+{
+    PyObject *seq_item, *res;
+    _psyco_curs_params params;
+    char *batch = NULL, *query, *tmp;
+    int offsets[BATCHSIZE + 1];
+    int i, len, count = 0, size = 0, used = 0, retvalue = -1;
+    int total = PyTuple_GET_SIZE(parm_seq);
+
+    params.operation = NULL;
+    params.values = NULL;
+    params.batch = offsets;
+
+    for (i = 0; i < total; i++) {
+        seq_item = PyTuple_GET_ITEM(parm_seq, i);
+        if (!(query = _psyco_curs_format(operation, seq_item))) goto cleanup;
+
+        len = strlen(query);
+        if (used + len + 3 > size) {
+            size = (used + len + 3) * 2;
+            if (!(tmp = (char *)realloc(batch, size))) {
+                free(query);
+                PyErr_NoMemory();
+                goto cleanup;
+            }
+            batch = tmp;
+        }
+        offsets[count] = used;
+        memcpy(batch + used, query, len);
+        used += len;
+        batch[used++] = '\n';
+        batch[used++] = ';';
+        batch[used] = '\0';
+        free(query);
+
+        if (++count == BATCHSIZE || i == total - 1) {
+            Dprintf("_psyco_curs_executebatch: sending %d queries\n", count);
+            offsets[count] = used;
+            params.nparams = count;
+            if (!(res = _psyco_curs_execute(self, batch, &params, NULL, NULL)))
+                goto cleanup;
+            Py_DECREF(res);
+            count = used = 0;
+        }
+    }
+    retvalue = 0;
+    
+  cleanup:
+    if (batch) free(batch);
+    return retvalue;
+}
 
 static PyObject *
-psyco_curs_executemany(cursobject *self, PyObject *args)
+psyco_curs_executemany(cursobject *self, PyObject *args, PyObject *kwords)
 {
-    PyObject *tmpobj, *parm_seq = NULL, *seq_item = NULL;
-    PyObject *operation = NULL, *last = NULL;
+    PyObject *parm_seq = NULL, *seq_item, *res;
+    PyObject *operation = NULL, *prepare = NULL;
     int i;
+    static char *kwlist[] = {"operation", "seq_of_parameters", "prepare",
+                             NULL};
 
-    if (!PyArg_ParseTuple(args, "O!O&",
-                          &PyString_Type, &operation,
-                          _psyco_curs_tuple_converter, &parm_seq)) {
+    EXC_IFCLOSED(self);
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwords, "O!O&|O", kwlist,
+                                     &PyString_Type, &operation,
+                                     _psyco_curs_tuple_converter, &parm_seq,
+                                     &prepare)) {
         return NULL;
     }
 
-    EXC_IFCLOSED(self);
-    
-    tmpobj = PyTuple_New(2);
-    
-    Py_INCREF(operation);
-    PyTuple_SET_ITEM(tmpobj, 0, operation);
-    for (i = 0; i < PyTuple_Size(parm_seq); i++) {
-        seq_item = PySequence_GetItem(parm_seq, i); 
+    for (i = 0; i < PyTuple_GET_SIZE(parm_seq); i++) {
+        seq_item = PyTuple_GET_ITEM(parm_seq, i); 
         if (!PyDict_Check(seq_item) && !PyTuple_Check(seq_item)) {
             PyErr_SetString(PyExc_TypeError,
                             "arg 2 must be a dictionary or tuple sequence");
-	    Py_DECREF(tmpobj);
-	    Py_DECREF(seq_item);
-	    Py_DECREF(parm_seq);
-            return NULL;
-        }
-        PyTuple_SET_ITEM(tmpobj, 1, seq_item);
-	if (last != NULL) {
-        Py_DECREF(last);
-	}
-	last = seq_item;
-        if(!psyco_curs_execute(self, tmpobj)) {
-            Py_DECREF(tmpobj);
             Py_DECREF(parm_seq);
             return NULL;
         }
     }
 
+    /* out-of-band parameters, server-side cursors and operations made of
+       more than one statement can't be batched and in autocommit mode every
+       statement must be committed on its own: they are executed one row at
+       a time */
+    if ((prepare && prepare != Py_None) || self->name
+        || self->isolation_level == 0
+        || strchr(PyString_AS_STRING(operation), ';')) {
+        for (i = 0; i < PyTuple_GET_SIZE(parm_seq); i++) {
+            seq_item = PyTuple_GET_ITEM(parm_seq, i);
+            res = _psyco_curs_execute_operation(self, operation, seq_item,
+                                                prepare);
+            if (res == NULL) {
+                Py_DECREF(parm_seq);
+                return NULL;
+            }
+            Py_DECREF(res);
+        }
+    }
+    else if (_psyco_curs_executebatch(self, operation, parm_seq) < 0) {
+        Py_DECREF(parm_seq);
+        return NULL;
+    }
+
     self->rowcount = -1;
     
-    Py_DECREF(tmpobj);
     Py_DECREF(parm_seq);
     Py_INCREF(Py_None);
     return Py_None;
 }
 
 
-/* psyco_curs_fetchone() - fetch onw row of data */
+/**** ROW MATERIALIZATION ****/
 
-static char psyco_curs_fetchone__doc__[] = 
-"Fetch the next row of a query result set, returning a "
-"single sequence, or None when no more data is available.";
+/* _psyco_curs_getvalue() - convert a single value of the current result
+ *
+ * uses the casting functions resolved by _psyco_curs_describe(): builtin
+ * types are converted directly from the libpq buffer, other C casts get a
+ * python string and only user-defined types go through the python call
+ * machinery (receiving None for NULL values, as they always did).
+ */
+inline static PyObject *
+_psyco_curs_getvalue(cursobject *self, long int row, int col)
+{
+    PyObject *val, *str, *arg;
+    psyco_CastInfo *info = NULL;
+    PGresult *r = self->pgres;
+    char *s;
+    int l;
+
+    if (self->castinfo) info = &(self->castinfo[col]);
+
+    if (PQgetisnull(r, row, col)) {
+        Dprintf("_psyco_curs_getvalue: row %ld, element %d is None\n",
+                row, col);
+        if (info && (info->rcast || info->ccast)) {
+            Py_INCREF(Py_None);
+            return Py_None;
+        }
+        Py_INCREF(Py_None);
+        str = Py_None;
+    }
+    else {
+        s = PQgetvalue(r, row, col);
+        l = PQgetlength(r, row, col);
+        Dprintf("_psyco_curs_getvalue: row %ld, element %d, len %i\n",
+                row, col, l);
+
+        if (info && info->rcast) {
+            if (info->memo) val = psyco_memo_rawcast(info, s, l);
+            else val = info->rcast(s, l);
+            if (val || PyErr_Occurred()) return val;
+        }
+        str = PyString_FromStringAndSize(s, l);
+        if (str == NULL) return NULL;
 
+        if (info && info->ccast) {
+            val = info->ccast(str);
+            Py_DECREF(str);
+            return val;
+        }
+    }
+
+    /* the slow path: call the type object (str reference is stolen) */
+    arg = PyTuple_New(1);
+    PyTuple_SET_ITEM(arg, 0, str);
+    val = PyObject_CallObject(PyTuple_GET_ITEM(self->casts, col), arg);
+    Py_DECREF(arg);
+    return val;
+}
+
+/* _psyco_curs_getrow() - convert a row of the current result
+ *
+ * returns a tuple or, if asdict is true, a dictionary keyed by the (interned)
+ * column names from the description.
+ */
 static PyObject *
-psyco_curs_fetchone(cursobject *self, PyObject *args)
+_psyco_curs_getrow(cursobject *self, long int row, int asdict)
+{
+    PyObject *res, *val;
+    int i, coln = self->columns;
+
+    if (asdict) res = PyDict_New();
+    else res = PyTuple_New(coln);
+    if (res == NULL) return NULL;
+
+    for (i = 0; i < coln; i++) {
+        val = _psyco_curs_getvalue(self, row, i);
+        if (val == NULL) {
+            /* an error occurred in the type system, we return NULL to raise
+               an exception. the typecast code should already have set the
+               exception type and text */
+            Py_DECREF(res);
+            return NULL;
+        }
+
+        if (asdict) {
+            PyObject *name =
+                PyTuple_GET_ITEM(PyTuple_GET_ITEM(self->description, i), 0);
+            PyDict_SetItem(res, name, val);
+            Py_DECREF(val);
+        }
+        else {
+            PyTuple_SET_ITEM(res, i, val);
+        }
+    }
+    return res;
+}
+
+/* _psyco_curs_getrows() - convert size rows starting at the current one
+ *
+ * the rows are appended to list (a new list is created if list is NULL) and
+ * the row counter is moved forward; size should not exceed the number of
+ * rows left in the current result.
+ */
+static PyObject *
+_psyco_curs_getrows(cursobject *self, PyObject *list, long int size,
+                    int asdict)
 {
-    int coln, i;
     PyObject *res;
-    PGresult *r;
-    
-    PARSEARGS(args);
+    long int i, first = self->row;
+    int append = (list != NULL);
+    double start = 0.0;
+
+    if (self->conn->instrument) start = psyco_gettime();
+    if (!append && !(list = PyList_New(size))) return NULL;
+
+    for (i = 0; i < size; i++) {
+        res = _psyco_curs_getrow(self, self->row, asdict);
+        self->row++; /* move the counter to next line */
+        if (res == NULL) {
+            Py_DECREF(list);
+            return NULL;
+        }
+
+        if (!append) {
+            PyList_SET_ITEM(list, i, res);
+        }
+        else {
+            int err = PyList_Append(list, res);
+            Py_DECREF(res);
+            if (err < 0) {
+                Py_DECREF(list);
+                return NULL;
+            }
+        }
+    }
+
+    if (self->conn->instrument) _psyco_curs_fetched(self, first, size, start);
+    return list;
+}
+
+/* _psyco_curs_fetchrow() - fetch the next row, used by (dict)fetchone() */
+static PyObject *
+_psyco_curs_fetchrow(cursobject *self, int asdict)
+{
+    PyObject *res;
+    double start = 0.0;
+
     EXC_IFCLOSED(self);
     EXC_IFNOTUPLES(self);
 
-    Dprintf("psyco_curs_fetchone: fetching row %ld\n", self->row);
+    Dprintf("_psyco_curs_fetchrow: fetching row %ld\n", self->row);
+
+    /* named cursors read the next batch when the current one is exhausted */
+    if (self->serverside && self->row >= self->ntuples) {
+        if (!self->declared) {
+            PyErr_SetString(ProgrammingError,
+                            "named cursor isn't valid anymore");
+            return NULL;
+        }
+        if (_psyco_curs_fetch_batch(self) < 0) return NULL;
+    }
     
-    if (self->row >= self->rowcount) {
+    if (self->row >= self->ntuples) {
         Py_INCREF(Py_None);
         return Py_None;
     }
-    
-    coln = PQnfields(self->pgres);
-    res = PyTuple_New(coln);
 
-    r = self->pgres;
-    for (i = 0; i < coln; i++) {
-        PyObject *val, *str;
-        PyObject *arg = PyTuple_New(1);
-        
-        if (PQgetisnull(r, self->row, i)) {
-            Py_INCREF(Py_None);
-            str = Py_None;
-            Dprintf("psyco_curs_fetchone: row %ld, element %d is None\n",
-                    self->row, i);
-        }
-        else {
-            char *s = PQgetvalue(r, self->row, i);
-            int l = PQgetlength(r, self->row, i);
-            str = PyString_FromStringAndSize(s, l);
-            Dprintf("psyco_curs_fetchone: row %ld, element %d, len %i\n",
-                    self->row, i, l);
-        }
+    if (self->conn->instrument) start = psyco_gettime();
+    res = _psyco_curs_getrow(self, self->row, asdict);
+    self->row++; /* move the counter to next line */
+    if (res && self->conn->instrument)
+        _psyco_curs_fetched(self, self->row - 1, 1, start);
+    return res;
+}
+
+/* _psyco_curs_fetchlist() - fetch size rows (all if size < 0) in a list
+ *
+ * used by the fetchmany()/fetchall() family; named cursors don't know in
+ * advance how many rows are left, so they convert a batch at a time until
+ * enough rows are available.
+ */
+static PyObject *
+_psyco_curs_fetchlist(cursobject *self, long int size, int asdict)
+{
+    PyObject *list;
+    long int n;
 
-        Dprintf("psyco_curs_fetchone: str->refcnt = %d\n", str->ob_refcnt);
-        PyTuple_SET_ITEM(arg, 0, str);
-        val = PyObject_CallObject(PyTuple_GET_ITEM(self->casts, i), arg);    
-        if (val) {
-            Dprintf("psyco_curs_fetchone: val->refcnt = %d\n", val->ob_refcnt);
+    EXC_IFCLOSED(self);
+    EXC_IFNOTUPLES(self);
+
+    if (!self->serverside) {
+        /* make sure size is not > than the available number of rows */
+        if (size > self->ntuples - self->row || size < 0) {
+            size = self->ntuples - self->row;
         }
-            Dprintf("psyco_curs_fetchone: str->refcnt = %d\n", str->ob_refcnt);
-        Py_DECREF(arg);
-        
-        if (val) {
-            PyTuple_SET_ITEM(res, i, val);
+
+        /* size < 0 should never happen with the calculation above */
+        assert(size >= 0); 
+    
+#ifdef DBAPIEXTENSIONS
+        /* if size is <= 0 there are no more rows, we return an error */
+        if (size == 0) {
+            PyErr_SetString(ProgrammingError, "no more results");
+            return NULL;
         }
-        else {
-            /* an error occurred in the type system, we return NULL to raise
-               an exception. the typecast code should already have set the
-               exception type and text */
-            res = NULL;
-            break;
+#endif
+        return _psyco_curs_getrows(self, NULL, size, asdict);
+    }
+
+    if (!(list = PyList_New(0))) return NULL;
+
+    while (size < 0 || PyList_GET_SIZE(list) < size) {
+        if (self->row >= self->ntuples) {
+            if (!self->declared) {
+                PyErr_SetString(ProgrammingError,
+                                "named cursor isn't valid anymore");
+                Py_DECREF(list);
+                return NULL;
+            }
+            if (_psyco_curs_fetch_batch(self) < 0) {
+                Py_DECREF(list);
+                return NULL;
+            }
+            if (self->ntuples == 0) break;
         }
+
+        n = self->ntuples - self->row;
+        if (size >= 0 && n > size - PyList_GET_SIZE(list))
+            n = size - PyList_GET_SIZE(list);
+        if (!(list = _psyco_curs_getrows(self, list, n, asdict)))
+            return NULL;
     }
-    
-    self->row++; /* move the counter to next line */
-    return res;
+    return list;
+}
+
+
+/* psyco_curs_fetchone() - fetch onw row of data */
+
+static char psyco_curs_fetchone__doc__[] = 
+"Fetch the next row of a query result set, returning a "
+"single sequence, or None when no more data is available.";
+
+static PyObject *
+psyco_curs_fetchone(cursobject *self, PyObject *args)
+{
+    PARSEARGS(args);
+    return _psyco_curs_fetchrow(self, 0);
 }
 
 
@@ -1479,49 +2983,14 @@ static char psyco_curs_fetchmany__doc__[] =
 static PyObject *
 psyco_curs_fetchmany(cursobject *self, PyObject *args, PyObject *kwords)
 {
-    long int size, i;
-    PyObject *list, *res;
+    long int size;
     static char *kwlist[] = {"size", NULL};
     
     size = self->arraysize;
     if (!PyArg_ParseTupleAndKeywords(args, kwords, "|l", kwlist, &size)) {
         return NULL;
     }
-
-    EXC_IFCLOSED(self);
-    EXC_IFNOTUPLES(self);
-
-    /* make sure size is not > than the available number of rows */
-    if (size > self->rowcount - self->row || size < 0) {
-        size = self->rowcount - self->row;
-    }
-
-    /* size < 0 should never happen with the calculation above */
-    assert(size >= 0); 
-    
-#ifdef DBAPIEXTENSIONS
-    /* if size is <= 0 there are no more rows, we return an error */
-    if (size == 0) {
-        PyErr_SetString(ProgrammingError, "no more results");
-        return NULL;
-    }
-#endif
-    
-    list = PyList_New(size);
-    for (i = 0; i < size; i++) {
-        res = psyco_curs_fetchone(self, NULL);
-
-        if (res == NULL) {
-            Py_DECREF(list);
-            return NULL;
-        }
-
-        /* the result can't be None, because we *know* how many rows to fetch */
-        assert(res != Py_None);
-        
-        PyList_SET_ITEM(list, i, res);
-    }
-    return list;
+    return _psyco_curs_fetchlist(self, size, 0);
 }
 
 
@@ -1534,35 +3003,8 @@ static char psyco_curs_fetchall__doc__[] =
 static PyObject *
 psyco_curs_fetchall(cursobject *self, PyObject *args)
 {
-    PyObject *res, *list;
-    int size, i;
-
     PARSEARGS(args);
-    EXC_IFCLOSED(self);
-    EXC_IFNOTUPLES(self);
-    
-    size = self->rowcount - self->row;
-    list = PyList_New(size);
-    
-#ifdef DBAPIEXTENSIONS
-    /* if size is <= 0 there are no more rows, we return an error */
-    if (size == 0) {
-        PyErr_SetString(ProgrammingError, "no more results");
-        return NULL;
-    }
-#endif
-    
-    for (i = 0; i < size; i++) {
-        res = psyco_curs_fetchone(self, NULL);
-        
-        if (res == NULL){
-            Py_DECREF(list);
-            return NULL;
-        }
-        assert(res != Py_None);
-        PyList_SET_ITEM(list, i, res);
-    }
-    return list;
+    return _psyco_curs_fetchlist(self, -1, 0);
 }
 
 
@@ -1575,31 +3017,8 @@ static char psyco_curs_dictfetchone__doc__[] =
 static PyObject *
 psyco_curs_dictfetchone(cursobject *self, PyObject *args)
 {
-    int i;
-    PyObject *dict, *res, *desc, *name;
-    PyObject *value = NULL;
-    
-    res = psyco_curs_fetchone(self, args);
-    if (res == NULL || res == Py_None) return res;
-
-    dict = PyDict_New();
-    for (i=0; i<self->columns; i++) {
-        /* obtain name from description (we incref it because the python
-           interpreter will decref on dict death) then set column value using
-           name as mapping key */
-        desc = PyTuple_GET_ITEM(self->description, i);
-        name = PyTuple_GET_ITEM(desc, 0);
-        value = PyTuple_GET_ITEM(res, i);
-        Dprintf("psyco_curs_dictfetchone: name.ob_refcnt = %d, "
-                "value.ob_refcnt = %d\n", name->ob_refcnt, value->ob_refcnt);
-        PyDict_SetItem(dict, name, value);
-        Dprintf("psyco_curs_dictfetchone: name.ob_refcnt = %d, "
-                "value.ob_refcnt = %d\n", name->ob_refcnt, value->ob_refcnt);
-    }
-    
-    Dprintf("psyco_curs_dictfetchone: res.ob_refcnt = %d\n", res->ob_refcnt);
-    Py_DECREF(res);
-    return dict;
+    PARSEARGS(args);
+    return _psyco_curs_fetchrow(self, 1);
 }
 
 /* psyco_curs_dictfetchmany() - fetch many rows into dictionaries */
@@ -1612,50 +3031,14 @@ static char psyco_curs_dictfetchmany__doc__[] =
 static PyObject *
 psyco_curs_dictfetchmany(cursobject *self, PyObject *args, PyObject *kwords)
 {
-    long int size, i;
-    PyObject *list, *res;
+    long int size;
     static char *kwlist[] = {"size", NULL};
     
     size = self->arraysize;
     if (!PyArg_ParseTupleAndKeywords(args, kwords, "|l", kwlist, &size)) {
         return NULL;
     }
-
-    EXC_IFCLOSED(self);
-    EXC_IFNOTUPLES(self);
-
-    /* make sure size is not > than the available number of rows */
-    if (size > self->rowcount - self->row || size < 0) {
-        size = self->rowcount - self->row;
-    }
-
-    /* size < 0 should never happen with the calculation above */
-    assert(size >= 0); 
-    
-#ifdef DBAPIEXTENSIONS
-    /* if size is <= 0 there are no more rows, we return an error */
-    if (size == 0) {
-        PyErr_SetString(ProgrammingError, "no more results");
-        return NULL;
-    }
-#endif
-    
-    list = PyList_New(size);
-    for (i = 0; i < size; i++) {
-        res = psyco_curs_dictfetchone(self, NULL);
-
-        if (res == NULL) {
-            Py_DECREF(list);
-            return NULL;
-        }
-
-        /* the result can't be None, because we *know* how many rows to
-           fetch */
-        assert(res != Py_None);
-        
-        PyList_SET_ITEM(list, i, res);
-    }
-    return list;
+    return _psyco_curs_fetchlist(self, size, 1);
 }
 
 
@@ -1668,34 +3051,7 @@ static char psyco_curs_dictfetchall__doc__[] =
 static PyObject *
 psyco_curs_dictfetchall(cursobject *self, PyObject *args)
 {
-    PyObject *res, *list;
-    int size, i;
-
-    EXC_IFCLOSED(self);
-    EXC_IFNOTUPLES(self);
-    
-    size = self->rowcount - self->row;
-    list = PyList_New(size);
-    
-#ifdef DBAPIEXTENSIONS
-    /* if size is <= 0 there are no more rows, we return an error */
-    if (size == 0) {
-        PyErr_SetString(ProgrammingError, "no more results");
-        return NULL;
-    }
-#endif
-    
-    for (i = 0; i < size; i++) {
-        res = psyco_curs_dictfetchone(self, NULL);
-        
-        if (res == NULL){
-            Py_DECREF(list);
-            return NULL;
-        }
-        assert(res != Py_None);
-        PyList_SET_ITEM(list, i, res);
-    }
-    return list;
+    return _psyco_curs_fetchlist(self, -1, 1);
 }
 
 
@@ -1754,7 +3110,8 @@ psyco_curs_nextset(cursobject *self, PyObject *args)
 {
     PARSEARGS(args);
     EXC_IFCLOSED(self);
-    self->row = self->rowcount;
+    self->row = self->ntuples;
+    _psyco_curs_close_named(self);
     Py_INCREF(Py_None);
     return Py_None;
 }
@@ -1789,35 +3146,394 @@ psyco_curs_autocommit(cursobject *self, PyObject *args)
 }
 
 
-/* psyco_curs_lastoid() - return the last oid from an insert or None */
-
-static char psyco_curs_lastoid__doc__[] =
-"Return the last oid from an insert or None.""";
+/* psyco_curs_lastoid() - return the last oid from an insert or None */
+
+static char psyco_curs_lastoid__doc__[] =
+"Return the last oid from an insert or None.""";
+
+static PyObject *
+psyco_curs_lastoid(cursobject *self, PyObject *args)
+{    
+    PARSEARGS(args);
+    EXC_IFCRITICAL(self);
+    
+    Dprintf("psyco_curs_lastoid: self->last_oid = %d on %p\n",
+            self->last_oid, self);
+
+    if (self->last_oid != InvalidOid) {
+        return PyInt_FromLong((long)self->last_oid);
+    }
+    else {
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+}
+
+
+/**** COPY SUPPORT ****/
+
+#if POSTGRESQL_MAJOR >= 8
+/* the buffer used to move COPY data between python and the backend */
+typedef struct {
+    char *data;
+    int   len;
+    int   size;
+} _psyco_copybuf;
+
+/* _psyco_copybuf_grow() - make room for n more bytes in the buffer
+ *
+ * this function does not need the GIL
+ */
+static int
+_psyco_copybuf_grow(_psyco_copybuf *buf, int n)
+{
+    char *tmp;
+    int size;
+
+    if (buf->len + n <= buf->size) return 0;
+
+    size = buf->size ? buf->size : COPYBUFSIZE;
+    while (size < buf->len + n) size *= 2;
+    if (!(tmp = (char *)realloc(buf->data, size))) return -1;
+    buf->data = tmp;
+    buf->size = size;
+    return 0;
+}
+
+/* _psyco_copybuf_reserve() - as above, raising MemoryError on failure */
+static int
+_psyco_copybuf_reserve(_psyco_copybuf *buf, int n)
+{
+    if (_psyco_copybuf_grow(buf, n) < 0) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    return 0;
+}
+
+/* _psyco_copybuf_escape() - append a string escaping COPY special chars
+ *
+ * if quoted is true s is a string already quoted by QuotedString: the
+ * surrounding quotes are dropped, doubled quotes are collapsed and the
+ * (already doubled) backslashes are copied as they are.
+ */
+static int
+_psyco_copybuf_escape(_psyco_copybuf *buf, char *s, int len, int quoted)
+{
+    char *c;
+    int i;
+
+    if (quoted) {
+        s++;
+        len -= 2;
+    }
+    if (_psyco_copybuf_reserve(buf, len*2) < 0) return -1;
+    c = buf->data + buf->len;
+
+    for (i = 0; i < len; i++) {
+        switch (s[i]) {
+        case '\\':
+            *c++ = '\\';
+            if (!quoted) *c++ = '\\';
+            else *c++ = s[++i];
+            break;
+        case '\'':
+            *c++ = '\'';
+            if (quoted) i++;
+            break;
+        case '\t':
+            *c++ = '\\'; *c++ = 't';
+            break;
+        case '\n':
+            *c++ = '\\'; *c++ = 'n';
+            break;
+        case '\r':
+            *c++ = '\\'; *c++ = 'r';
+            break;
+        case '\0':
+            /* embedded \0 are discarded, as QuotedString does */
+            break;
+        default:
+            *c++ = s[i];
+        }
+    }
+    buf->len = c - buf->data;
+    return 0;
+}
+
+/* _psyco_copybuf_append() - append a string as it is */
+static int
+_psyco_copybuf_append(_psyco_copybuf *buf, char *s, int len)
+{
+    if (_psyco_copybuf_reserve(buf, len) < 0) return -1;
+    memcpy(buf->data + buf->len, s, len);
+    buf->len += len;
+    return 0;
+}
+
+/* _psyco_copybuf_value() - append a python value in COPY text format
+ *
+ * None becomes \N, strings are escaped, Binary and date/time objects are
+ * already escaped and are just stripped of their quotes; everything else is
+ * converted with str().
+ */
+static int
+_psyco_copybuf_value(_psyco_copybuf *buf, PyObject *value)
+{
+    PyObject *str;
+    int r;
+
+    if (value == Py_None) {
+        return _psyco_copybuf_append(buf, "\\N", 2);
+    }
+    else if (PyString_Check(value)) {
+        return _psyco_copybuf_escape(buf, PyString_AS_STRING(value),
+                                     PyString_GET_SIZE(value), 0);
+    }
+    else if (PyObject_TypeCheck(value, &psyco_QuotedStringObject_Type)) {
+        str = ((psyco_QuotedStringObject *)value)->buffer;
+        return _psyco_copybuf_escape(buf, PyString_AS_STRING(str),
+                                     PyString_GET_SIZE(str), 1);
+    }
+    else if (PyObject_TypeCheck(value, &psyco_BufferObject_Type)) {
+        str = ((psyco_BufferObject *)value)->buffer;
+        return _psyco_copybuf_append(buf, PyString_AS_STRING(str) + 1,
+                                     PyString_GET_SIZE(str) - 2);
+    }
+
+    if (!(str = PyObject_Str(value))) return -1;
+    if (PyObject_TypeCheck(value, &psyco_DateTimeObject_Type))
+        r = _psyco_copybuf_append(buf, PyString_AS_STRING(str) + 1,
+                                  PyString_GET_SIZE(str) - 2);
+    else
+        r = _psyco_copybuf_escape(buf, PyString_AS_STRING(str),
+                                  PyString_GET_SIZE(str), 0);
+    Py_DECREF(str);
+    return r;
+}
+
+/* _psyco_curs_copy_flush() - send the buffer to the backend and empty it
+ *
+ * this function locks the keeper
+ * this function enters an ALLOW_THREADS wrapper
+ */
+static int
+_psyco_curs_copy_flush(cursobject *self, _psyco_copybuf *buf)
+{
+    int r;
+
+    Dprintf("_psyco_curs_copy_flush: sending %d bytes\n", buf->len);
+    pthread_mutex_lock(&(self->keeper->lock));
+    Py_BEGIN_ALLOW_THREADS;
+    r = PQputCopyData(self->pgconn, buf->data, buf->len);
+    pthread_mutex_unlock(&(self->keeper->lock));
+    Py_END_ALLOW_THREADS;
+
+    buf->len = 0;
+    if (r != 1) {
+        PyErr_SetString(OperationalError, PQerrorMessage(self->pgconn));
+        return -1;
+    }
+    return 0;
+}
+
+/* pgconn_copy_result() - read the results of a terminated COPY
+ *
+ * returns the last result, to be cleared by the caller
+ *
+ * this function does not call Py_*_ALLOW_THREADS macros
+ * this function does not lock the keeper and should be called while
+ *   holding a lock on it
+ */
+static PGresult *
+pgconn_copy_result(PGconn *pgconn)
+{
+    PGresult *pgres, *last = NULL;
+
+    while ((pgres = PQgetResult(pgconn)) != NULL) {
+        IFCLEARPGRES(last);
+        last = pgres;
+    }
+    return last;
+}
+
+/* _psyco_curs_copy_status() - check the result of a terminated COPY
+ *
+ * sets rowcount from the "COPY n" command status (backends >= 8.2) and
+ * raises an exception if the COPY failed. clears the result.
+ */
+static int
+_psyco_curs_copy_status(cursobject *self, PGresult *pgres)
+{
+    char *ntuples;
+    int retvalue = -1;
+
+    if (pgres == NULL) {
+        PyErr_SetString(OperationalError, PQerrorMessage(self->pgconn));
+    }
+    else if (PQresultStatus(pgres) != PGRES_COMMAND_OK) {
+        pgres_set_error(pgres, NULL);
+    }
+    else {
+        ntuples = PQcmdTuples(pgres);
+        if (ntuples[0]) self->rowcount = atol(ntuples);
+        retvalue = 0;
+    }
+    IFCLEARPGRES(pgres);
+    return retvalue;
+}
+
+/* _psyco_curs_copy_end() - terminate a COPY FROM and check its result
+ *
+ * if errmsg is not NULL the COPY is aborted and the result discarded
+ * (an exception should already be set.)
+ *
+ * this function locks the keeper
+ * this function enters an ALLOW_THREADS wrapper
+ */
+static int
+_psyco_curs_copy_end(cursobject *self, char *errmsg)
+{
+    PGresult *pgres = NULL;
+    int r;
+    
+    pthread_mutex_lock(&(self->keeper->lock));
+    Py_BEGIN_ALLOW_THREADS;
+    r = PQputCopyEnd(self->pgconn, errmsg);
+    if (r == 1) pgres = pgconn_copy_result(self->pgconn);
+    pthread_mutex_unlock(&(self->keeper->lock));
+    Py_END_ALLOW_THREADS;
+
+    if (errmsg) {
+        IFCLEARPGRES(pgres);
+        return -1;
+    }
+    return _psyco_curs_copy_status(self, pgres);
+}
+
+/* _psyco_fd_write() - write a whole buffer to a file descriptor
+ *
+ * this function does not need the GIL
+ */
+static int
+_psyco_fd_write(int fd, char *data, int len)
+{
+    int n;
+
+    while (len > 0) {
+        if ((n = write(fd, data, len)) < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+#endif
+
+/* psyco_curs_copy_to() - copy a table to a local file */
+
+static char psyco_curs_copy_to__doc__[] =
+"Copy table to a local file.\ncopy_to(fileObject, tablename, <separator>, <null identifier>)\n"
+"fileObject can be a file, a file descriptor or any object with a write()\n"
+"method.""";
 
+#if POSTGRESQL_MAJOR >= 8
+/* _psyco_curs_copy_to() - read the COPY data and write it to file
+ *
+ * file descriptors and python files are written without holding the GIL
+ * for the whole COPY; other objects get a write() call every COPYBUFSIZE
+ * bytes.
+ *
+ * this function locks the keeper
+ * this function enters an ALLOW_THREADS wrapper
+ */
 static PyObject *
-psyco_curs_lastoid(cursobject *self, PyObject *args)
-{    
-    PARSEARGS(args);
-    EXC_IFCRITICAL(self);
-    
-    Dprintf("psyco_curs_lastoid: self->last_oid = %d on %p\n",
-            self->last_oid, self);
+_psyco_curs_copy_to(cursobject *self, PyObject *file)
+{
+    _psyco_copybuf buf = {NULL, 0, 0};
+    PGresult *pgres = NULL;
+    PyObject *o, *r;
+    FILE *fp = NULL;
+    char *data;
+    int len, fd = -1, err = 0, failed = 0;
 
-    if (self->last_oid != InvalidOid) {
-        return PyInt_FromLong((long)self->last_oid);
+    if (PyInt_Check(file)) {
+        fd = (int)PyInt_AS_LONG(file);
     }
-    else {
-        Py_INCREF(Py_None);
-        return Py_None;
+    else if (PyFile_Check(file)) {
+        if (!(fp = PyFile_AsFile(file))) {
+            PyErr_SetString(PyExc_ValueError, "I/O operation on closed file");
+            failed = 1;
+        }
+#if PY_VERSION_HEX >= 0x02060000
+        else PyFile_IncUseCount((PyFileObject *)file);
+#endif
     }
-}
 
+    do {
+        pthread_mutex_lock(&(self->keeper->lock));
+        Py_BEGIN_ALLOW_THREADS;
+        while ((len = PQgetCopyData(self->pgconn, &data, 0)) > 0) {
+            /* after an error we just drain the data from the backend */
+            if (err || failed)
+                ;
+            else if (fd >= 0) {
+                if (_psyco_fd_write(fd, data, len) < 0) err = errno;
+            }
+            else if (fp) {
+                if ((int)fwrite(data, 1, len, fp) != len) err = errno;
+            }
+            else if (_psyco_copybuf_grow(&buf, len) < 0) {
+                err = ENOMEM;
+            }
+            else {
+                memcpy(buf.data + buf.len, data, len);
+                buf.len += len;
+            }
+            PQfreemem(data);
+            if (buf.len >= COPYBUFSIZE) break;
+        }
+        if (len < 0) pgres = pgconn_copy_result(self->pgconn);
+        pthread_mutex_unlock(&(self->keeper->lock));
+        Py_END_ALLOW_THREADS;
 
-/* psyco_curs_copy_to() - copy a table to a local file */
+        if (buf.len > 0) {
+            o = PyString_FromStringAndSize(buf.data, buf.len);
+            buf.len = 0;
+            r = o ? PyObject_CallMethod(file, "write", "O", o) : NULL;
+            Py_XDECREF(o);
+            Py_XDECREF(r);
+            if (r == NULL) failed = 1;
+        }
+    } while (len > 0);
 
-static char psyco_curs_copy_to__doc__[] =
-"Copy table to a local file.\ncopy_to(fileObject, tablename, <separator>, <null identifier>)""";
+#if PY_VERSION_HEX >= 0x02060000
+    if (fp) PyFile_DecUseCount((PyFileObject *)file);
+#endif
+    if (buf.data) free(buf.data);
 
+    if (len == -2) {
+        IFCLEARPGRES(pgres);
+        if (!failed)
+            PyErr_SetString(OperationalError, PQerrorMessage(self->pgconn));
+        return NULL;
+    }
+    if (failed || err) {
+        IFCLEARPGRES(pgres);
+        if (err) {
+            errno = err;
+            PyErr_SetFromErrno(PyExc_IOError);
+        }
+        return NULL;
+    }
+    if (_psyco_curs_copy_status(self, pgres) < 0) return NULL;
+    
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+#else
 static PyObject *
 _psyco_curs_copy_to(cursobject *self, PyObject *file)
 {
@@ -1850,18 +3566,22 @@ _psyco_curs_copy_to(cursobject *self, PyObject *file)
     Py_INCREF(Py_None);
     return Py_None;
 }
+#endif
      
 static PyObject *
 psyco_curs_copy_to(cursobject *self, PyObject *args)
 {
     char *table_name, *query = NULL;
     char *sep = "\t", *null =NULL;
-    PyObject *file;
+    PyObject *file, *res;
 
     if (!PyArg_ParseTuple(args, "Os|ss", &file, &table_name, &sep, &null)) {
         return NULL;
     }
-    if (!PyObject_GetAttrString(file, "write")) {
+    if (!PyInt_Check(file) && !PyFile_Check(file)
+        && !PyObject_HasAttrString(file, "write")) {
+        PyErr_SetString(PyExc_TypeError,
+                        "argument 1 must be a file or have a write() method");
         return NULL;
     }
     
@@ -1877,11 +3597,63 @@ psyco_curs_copy_to(cursobject *self, PyObject *args)
     }
     Dprintf("psyco_curs_copy_to: query = %s\n", query);
     
-    _psyco_curs_execute(self, query, _psyco_curs_copy_to, file);
+    res = _psyco_curs_execute(self, query, NULL, _psyco_curs_copy_to, file);
     free(query);
 
-    Py_INCREF(Py_None);
-    return Py_None;
+    return res;
+}
+
+/* _psyco_curs_move() - move a named cursor to an absolute position
+ *
+ * the current batch (and any prefetched one) is discarded, the next fetch
+ * will read rows starting at position newpos.
+ *
+ * this function locks the keeper
+ * this function enters an ALLOW_THREADS wrapper
+ */
+static int
+_psyco_curs_move(cursobject *self, long int newpos)
+{
+    char *query = NULL;
+    PGresult *pgres = NULL;
+    int retvalue = -1;
+
+    if (!self->declared) {
+        PyErr_SetString(ProgrammingError, "named cursor isn't valid anymore");
+        return -1;
+    }
+    if (asprintf(&query, "MOVE ABSOLUTE %ld FROM %s", newpos, self->name) < 0) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    Dprintf("_psyco_curs_move: query = %s\n", query);
+
+    pthread_mutex_lock(&(self->keeper->lock));
+    Py_BEGIN_ALLOW_THREADS;
+    _psyco_curs_drain(self);
+    pgres = PQexec(self->pgconn, query);
+    pthread_mutex_unlock(&(self->keeper->lock));
+    Py_END_ALLOW_THREADS;
+    free(query);
+
+    if (pgres == NULL) {
+        pgconn_set_critical(self);
+        pgconn_resolve_critical(self);
+        return -1;
+    }
+    if (PQresultStatus(pgres) != PGRES_COMMAND_OK) {
+        PyErr_SetString(ProgrammingError, PQresultErrorMessage(pgres));
+        goto cleanup;
+    }
+
+    IFCLEARPGRES(self->pgres);
+    self->row = self->ntuples = 0;
+    self->pos = newpos;
+    retvalue = 0;
+
+ cleanup:
+    IFCLEARPGRES(pgres);
+    return retvalue;
 }
 
 static char psyco_curs_scroll__doc__[] =
@@ -1891,7 +3663,7 @@ static char psyco_curs_scroll__doc__[] =
 static PyObject *
 psyco_curs_scroll(cursobject *self, PyObject *args, PyObject *kwords)
 {
-    int value, newpos;
+    int value, newpos, base = 0;
     char *mode = "relative";
 
     static char *kwlist[] = {"value", "mode", NULL};
@@ -1901,8 +3673,16 @@ psyco_curs_scroll(cursobject *self, PyObject *args, PyObject *kwords)
         return NULL;
     }
 
+    /* on named cursors self->row is relative to the current batch, that
+       starts at row (pos - ntuples) of the whole result */
+    if (self->serverside) {
+        EXC_IFCLOSED(self);
+        EXC_IFNOTUPLES(self);
+        base = self->pos - self->ntuples;
+    }
+
     if (strcmp(mode, "relative") == 0) {
-        newpos = self->row + value;
+        newpos = base + self->row + value;
     } else if ( strcmp( mode, "absolute") == 0) {
         newpos = value;
     } else {
@@ -1911,6 +3691,22 @@ psyco_curs_scroll(cursobject *self, PyObject *args, PyObject *kwords)
         return NULL;
     }
 
+    if (self->serverside) {
+        if (newpos < 0) {
+            PyErr_SetString(PyExc_IndexError,
+                            "scroll destination is out of bounds");
+            return NULL;
+        }
+        if (newpos >= base && newpos < self->pos) {
+            self->row = newpos - base;
+        }
+        else if (_psyco_curs_move(self, newpos) < 0) {
+            return NULL;
+        }
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+
     if (newpos < 0 || newpos >= self->rowcount ) {
         PyErr_SetString(PyExc_IndexError,
                         "scroll destination is out of bounds");
@@ -1925,8 +3721,162 @@ psyco_curs_scroll(cursobject *self, PyObject *args, PyObject *kwords)
 /* psyco_curs_copy_from() - copy a table from a local file */
 
 static char psyco_curs_copy_from__doc__[] =
-"Copy table from a local file.\ncopy_from(fileObject, tablename, <separator>, <null identifier>)""";
+"Copy table from a local file.\ncopy_from(fileObject, tablename, <separator>, <null identifier>)\n"
+"fileObject can be a file, a file descriptor, an object supporting the\n"
+"buffer interface (like a string) or any object with a read() or\n"
+"readline() method.""";
+
+#if POSTGRESQL_MAJOR >= 8
+/* _psyco_curs_copy_from() - read data from file and send it to the backend
+ *
+ * file descriptors and python files are read COPYBUFSIZE bytes at a time
+ * and strings are sent directly from their memory, both without holding
+ * the GIL for the whole COPY; other buffer objects are copied and sent
+ * COPYBUFSIZE bytes at a time and the remaining objects are read() in
+ * chunks of COPYBUFSIZE bytes (or readline()d if they don't have a read
+ * method.)
+ *
+ * this function locks the keeper
+ * this function enters an ALLOW_THREADS wrapper
+ */
+static PyObject *
+_psyco_curs_copy_from(cursobject *self, PyObject *file)
+{
+    PyObject *o;
+    FILE *fp = NULL;
+    const void *mem;
+    Py_ssize_t size, pos;
+    char *data;
+    int len, fd = -1, err = 0, r = 1;
+
+    if (PyInt_Check(file) || PyFile_Check(file)) {
+        if (PyInt_Check(file)) {
+            fd = (int)PyInt_AS_LONG(file);
+        }
+        else if (!(fp = PyFile_AsFile(file))) {
+            PyErr_SetString(PyExc_ValueError, "I/O operation on closed file");
+            goto abort;
+        }
+        if (!(data = (char *)malloc(COPYBUFSIZE))) {
+            PyErr_NoMemory();
+            goto abort;
+        }
+#if PY_VERSION_HEX >= 0x02060000
+        if (fp) PyFile_IncUseCount((PyFileObject *)file);
+#endif
+
+        pthread_mutex_lock(&(self->keeper->lock));
+        Py_BEGIN_ALLOW_THREADS;
+        while (r == 1) {
+            if (fd >= 0) {
+                len = read(fd, data, COPYBUFSIZE);
+                if (len < 0 && errno == EINTR) continue;
+            }
+            else {
+                len = fread(data, 1, COPYBUFSIZE, fp);
+                if (len == 0 && ferror(fp)) len = -1;
+            }
+            if (len < 0) {
+                err = errno;
+                break;
+            }
+            if (len == 0) break;
+            r = PQputCopyData(self->pgconn, data, len);
+        }
+        pthread_mutex_unlock(&(self->keeper->lock));
+        Py_END_ALLOW_THREADS;
+
+#if PY_VERSION_HEX >= 0x02060000
+        if (fp) PyFile_DecUseCount((PyFileObject *)file);
+#endif
+        free(data);
+    }
+    else if (PyString_Check(file)) {
+        /* strings are immutable and we hold a reference to this one */
+        mem = PyString_AS_STRING(file);
+        size = PyString_GET_SIZE(file);
+
+        pthread_mutex_lock(&(self->keeper->lock));
+        Py_BEGIN_ALLOW_THREADS;
+        for (pos = 0; pos < size && r == 1; pos += len) {
+            len = (size - pos) > COPYBUFSIZE ? COPYBUFSIZE : (int)(size - pos);
+            r = PQputCopyData(self->pgconn, (const char *)mem + pos, len);
+        }
+        pthread_mutex_unlock(&(self->keeper->lock));
+        Py_END_ALLOW_THREADS;
+    }
+    else if (PyObject_CheckReadBuffer(file)) {
+        /* other buffers can be resized or freed by another thread as soon
+           as the GIL is released: every chunk is copied in a private buffer
+           and the pointer is asked again to the object after each send */
+        if (!(data = (char *)malloc(COPYBUFSIZE))) {
+            PyErr_NoMemory();
+            goto abort;
+        }
+        for (pos = 0; r == 1; pos += len) {
+            if (PyObject_AsReadBuffer(file, &mem, &size) < 0) {
+                free(data);
+                goto abort;
+            }
+            if (pos >= size) break;
+            len = (size - pos) > COPYBUFSIZE ? COPYBUFSIZE : (int)(size - pos);
+            memcpy(data, (const char *)mem + pos, len);
+
+            pthread_mutex_lock(&(self->keeper->lock));
+            Py_BEGIN_ALLOW_THREADS;
+            r = PQputCopyData(self->pgconn, data, len);
+            pthread_mutex_unlock(&(self->keeper->lock));
+            Py_END_ALLOW_THREADS;
+        }
+        free(data);
+    }
+    else {
+        int chunked = PyObject_HasAttrString(file, "read");
+        
+        while (r == 1) {
+            if (chunked)
+                o = PyObject_CallMethod(file, "read", "i", COPYBUFSIZE);
+            else
+                o = PyObject_CallMethod(file, "readline", NULL);
+            if (o == NULL) goto abort;
+            if (o == Py_None || !PyString_Check(o) || !PyString_GET_SIZE(o)) {
+                if (o != Py_None && !PyString_Check(o))
+                    PyErr_SetString(PyExc_TypeError,
+                                    "copy_from() file must return strings");
+                Py_DECREF(o);
+                if (PyErr_Occurred()) goto abort;
+                break;
+            }
+
+            pthread_mutex_lock(&(self->keeper->lock));
+            Py_BEGIN_ALLOW_THREADS;
+            r = PQputCopyData(self->pgconn, PyString_AS_STRING(o),
+                              PyString_GET_SIZE(o));
+            pthread_mutex_unlock(&(self->keeper->lock));
+            Py_END_ALLOW_THREADS;
+            Py_DECREF(o);
+        }
+    }
+
+    if (err) {
+        errno = err;
+        PyErr_SetFromErrno(PyExc_IOError);
+        goto abort;
+    }
+    if (r != 1) {
+        PyErr_SetString(OperationalError, PQerrorMessage(self->pgconn));
+        goto abort;
+    }
+    if (_psyco_curs_copy_end(self, NULL) < 0) return NULL;
+   
+    Py_INCREF(Py_None);
+    return Py_None;
 
+  abort:
+    _psyco_curs_copy_end(self, "copy_from() failed");
+    return NULL;
+}
+#else
 static PyObject *
 _psyco_curs_copy_from(cursobject *self, PyObject *file)
 {
@@ -1948,6 +3898,7 @@ _psyco_curs_copy_from(cursobject *self, PyObject *file)
     Py_INCREF(Py_None);
     return Py_None;
 }
+#endif
      
 static PyObject *
 psyco_curs_copy_from(cursobject *self, PyObject *args)
@@ -1959,7 +3910,12 @@ psyco_curs_copy_from(cursobject *self, PyObject *args)
     if (!PyArg_ParseTuple(args, "Os|ss", &file, &table_name, &sep, &null)) {
         return NULL;
     }
-    if (!PyObject_HasAttrString(file, "readline")) {
+    if (!PyInt_Check(file) && !PyFile_Check(file)
+        && !PyObject_CheckReadBuffer(file)
+        && !PyObject_HasAttrString(file, "read")
+        && !PyObject_HasAttrString(file, "readline")) {
+        PyErr_SetString(PyExc_TypeError, "argument 1 must be a file, "
+                        "a buffer or have a read() or readline() method");
         return NULL;
     }
 
@@ -1975,12 +3931,135 @@ psyco_curs_copy_from(cursobject *self, PyObject *args)
     }
     Dprintf("psyco_curs_copy_from: query = %s\n", query);
     
-    res = _psyco_curs_execute(self, query, _psyco_curs_copy_from, file);
+    res = _psyco_curs_execute(self, query, NULL, _psyco_curs_copy_from, file);
     free(query);
     
     return res;
 }
 
+#if POSTGRESQL_MAJOR >= 8
+/* psyco_curs_copy_records() - bulk insert python sequences using COPY */
+
+static char psyco_curs_copy_records__doc__[] =
+"Insert rows in a table using COPY, encoding them to the COPY format in C.\n"
+"copy_records(tablename, columns, rows): columns is a sequence of column\n"
+"names (None for all the columns) and rows an iterable of sequences.";
+
+static PyObject *
+_psyco_curs_copy_records(cursobject *self, PyObject *args)
+{
+    PyObject *iter, *row, *seq;
+    _psyco_copybuf buf = {NULL, 0, 0};
+    long int nrows = 0;
+    int i, n, ncols;
+
+    iter = PyTuple_GET_ITEM(args, 0);
+    ncols = (int)PyInt_AS_LONG(PyTuple_GET_ITEM(args, 1));
+
+    while ((row = PyIter_Next(iter)) != NULL) {
+        seq = PySequence_Fast(row, "copy_records() rows must be sequences");
+        Py_DECREF(row);
+        if (seq == NULL) goto abort;
+
+        n = PySequence_Fast_GET_SIZE(seq);
+        if (ncols < 0) ncols = n;
+        if (n != ncols || n == 0) {
+            Py_DECREF(seq);
+            PyErr_SetString(ProgrammingError,
+                            "wrong number of values in copy_records() row");
+            goto abort;
+        }
+        
+        for (i = 0; i < n; i++) {
+            if ((i > 0 && _psyco_copybuf_append(&buf, "\t", 1) < 0)
+                || _psyco_copybuf_value(&buf,
+                                        PySequence_Fast_GET_ITEM(seq, i)) < 0) {
+                Py_DECREF(seq);
+                goto abort;
+            }
+        }
+        Py_DECREF(seq);
+        
+        if (_psyco_copybuf_append(&buf, "\n", 1) < 0) goto abort;
+        nrows++;
+
+        if (buf.len >= COPYBUFSIZE && _psyco_curs_copy_flush(self, &buf) < 0)
+            goto abort;
+    }
+    if (PyErr_Occurred()) goto abort;
+
+    if (buf.len > 0 && _psyco_curs_copy_flush(self, &buf) < 0) goto abort;
+    if (buf.data) free(buf.data);
+    if (_psyco_curs_copy_end(self, NULL) < 0) return NULL;
+
+    self->rowcount = nrows;
+    Py_INCREF(Py_None);
+    return Py_None;
+
+  abort:
+    if (buf.data) free(buf.data);
+    _psyco_curs_copy_end(self, "copy_records() failed");
+    return NULL;
+}
+
+static PyObject *
+psyco_curs_copy_records(cursobject *self, PyObject *args)
+{
+    char *table_name, *query = NULL;
+    PyObject *columns, *rows, *iter, *names = NULL, *sep, *cbargs, *res;
+    int ncols = -1;
+
+    if (!PyArg_ParseTuple(args, "sOO", &table_name, &columns, &rows)) {
+        return NULL;
+    }
+
+    EXC_IFCLOSED(self);
+    EXC_IFCRITICAL(self);
+
+    if (columns != Py_None) {
+        if (PyString_Check(columns) || !PySequence_Check(columns)) {
+            PyErr_SetString(PyExc_TypeError,
+                            "columns must be a sequence of names or None");
+            return NULL;
+        }
+        sep = PyString_FromString(", ");
+        names = PyObject_CallMethod(sep, "join", "O", columns);
+        Py_DECREF(sep);
+        if (names == NULL) return NULL;
+        ncols = PySequence_Size(columns);
+    }
+
+    if (!(iter = PyObject_GetIter(rows))) {
+        Py_XDECREF(names);
+        return NULL;
+    }
+
+    if (names) {
+        asprintf(&query, "COPY %s (%s) FROM stdin",
+                 table_name, PyString_AS_STRING(names));
+    }
+    else {
+        asprintf(&query, "COPY %s FROM stdin", table_name);
+    }
+    Py_XDECREF(names);
+    Dprintf("psyco_curs_copy_records: query = %s\n", query);
+    
+    cbargs = Py_BuildValue("(Oi)", iter, ncols);
+    Py_DECREF(iter);
+    if (query == NULL || cbargs == NULL) {
+        if (query) free(query);
+        Py_XDECREF(cbargs);
+        return PyErr_NoMemory();
+    }
+    
+    res = _psyco_curs_execute(self, query, NULL,
+                              _psyco_curs_copy_records, cbargs);
+    free(query);
+    Py_DECREF(cbargs);
+    return res;
+}
+#endif
+
 static char psyco_curs_notifies__doc__[] = "Returns list of notifies.";
 
 static PyObject *
@@ -2013,6 +4092,48 @@ psyco_curs_fileno(cursobject *self, PyObject *args)
 {
     return PyInt_FromLong(PQsocket(self->pgconn));
 }
+/* psyco_curs_stmtcache() - statistics about the prepared statements cache */
+
+static char psyco_curs_stmtcache__doc__[] =
+"Returns a dictionary with the hits, misses and size of the prepared\n"
+"statements cache of the cursor's connection.";
+
+static PyObject *
+psyco_curs_stmtcache(cursobject *self, PyObject *args)
+{
+    long int hits, misses;
+    int size;
+
+    PARSEARGS(args);
+    EXC_IFCLOSED(self);
+
+    pthread_mutex_lock(&(self->keeper->lock));
+    hits = self->keeper->hits;
+    misses = self->keeper->misses;
+    size = self->keeper->nstmts;
+    pthread_mutex_unlock(&(self->keeper->lock));
+
+    return Py_BuildValue("{s:l,s:l,s:i,s:i}", "hits", hits, "misses", misses,
+                         "size", size, "maxsize", MAXSTMTS);
+}
+
+/* psyco_curs_stats() - statistics about the last query */
+
+static char psyco_curs_stats__doc__[] =
+"Returns a dictionary with the statistics of the last query executed by\n"
+"the cursor, if its connection is instrumented: the seconds spent\n"
+"executing it, building the description, converting rows and waiting for\n"
+"the connection lock and the number of rows and bytes converted so far.";
+
+static PyObject *
+psyco_curs_stats(cursobject *self, PyObject *args)
+{
+    PARSEARGS(args);
+    EXC_IFCLOSED(self);
+
+    return _psyco_curs_stats(self);
+}
+
 /**** CURSOR OBJECT DEFINITION ****/
 
 /* object methods list */
@@ -2027,9 +4148,15 @@ static struct PyMethodDef psyco_curs_methods[] = {
     {"callproc", (PyCFunction)psyco_curs_callproc,
      METH_VARARGS, psyco_curs_callproc__doc__},
     {"execute", (PyCFunction)psyco_curs_execute,
-     METH_VARARGS, psyco_curs_execute__doc__},
+     METH_VARARGS|METH_KEYWORDS, psyco_curs_execute__doc__},
     {"executemany", (PyCFunction)psyco_curs_executemany,
-     METH_VARARGS, psyco_curs_executemany__doc__},
+     METH_VARARGS|METH_KEYWORDS, psyco_curs_executemany__doc__},
+    {"execute_async", (PyCFunction)psyco_curs_execute_async,
+     METH_VARARGS, psyco_curs_execute_async__doc__},
+    {"isready", (PyCFunction)psyco_curs_isready,
+     METH_VARARGS, psyco_curs_isready__doc__},
+    {"poll", (PyCFunction)psyco_curs_poll,
+     METH_VARARGS, psyco_curs_poll__doc__},
     {"fetchone", (PyCFunction)psyco_curs_fetchone,
      METH_VARARGS, psyco_curs_fetchone__doc__},
     {"fetchmany", (PyCFunction)psyco_curs_fetchmany,
@@ -2056,12 +4183,20 @@ static struct PyMethodDef psyco_curs_methods[] = {
      METH_VARARGS, psyco_curs_copy_to__doc__},
     {"copy_from", (PyCFunction)psyco_curs_copy_from,
      METH_VARARGS, psyco_curs_copy_from__doc__},
+#if POSTGRESQL_MAJOR >= 8
+    {"copy_records", (PyCFunction)psyco_curs_copy_records,
+     METH_VARARGS, psyco_curs_copy_records__doc__},
+#endif
     {"scroll", (PyCFunction)psyco_curs_scroll,
      METH_VARARGS|METH_KEYWORDS, psyco_curs_scroll__doc__},
     {"notifies", (PyCFunction)psyco_curs_notifies,
      METH_VARARGS, psyco_curs_notifies__doc__},
     {"fileno", (PyCFunction)psyco_curs_fileno,
      METH_VARARGS, psyco_curs_fileno__doc__},
+    {"stmtcache", (PyCFunction)psyco_curs_stmtcache,
+     METH_VARARGS, psyco_curs_stmtcache__doc__},
+    {"stats", (PyCFunction)psyco_curs_stats,
+     METH_VARARGS, psyco_curs_stats__doc__},
     {NULL, NULL}
 };
 
@@ -2076,6 +4211,7 @@ static struct memberlist psyco_curs_memberlist[] = {
     {"description", T_OBJECT,OFFSETOF(description), RO},
     {"lastrowid", T_LONG,OFFSETOF(last_oid), RO},
     {"statusmessage", T_OBJECT,OFFSETOF(status), RO},
+    {"datememo", T_INT, OFFSETOF(datememo), 0},
     {NULL}	
 };
 
@@ -2114,19 +4250,9 @@ psyco_curs_destroy(cursobject *self)
     _psyco_curs_destroy(self);
     Py_XDECREF(self->description);
     Py_XDECREF(self->status);
+    if (self->name) free(self->name);
+    if (self->asyncquery) free(self->asyncquery);
 
-    /* close unwanted open connections to keep the number of opened
-       connections low */
-    if (self->conn
-        && PyList_Size(self->conn->avail_conn) > self->conn->minconn) {
-        connkeeper *closing = _extract_keeper(self->conn);
-        if (closing) {
-            PQfinish(closing->pgconn);
-            pthread_mutex_destroy(&(closing->lock));
-            free(closing);
-        }
-    }
-    
     Dprintf("psyco_curs_destroy: cursor at %p destroyed, refcnt = %d\n",
             self, self->ob_refcnt);
     PyObject_Del(self);
@@ -2168,15 +4294,38 @@ static PyTypeObject Curstype = {
 
 
 
+/* _psyco_curs_quote_name() - quote a cursor name as a SQL identifier */
+static char *
+_psyco_curs_quote_name(char *name)
+{
+    char *quoted;
+    int i, j, len = strlen(name);
+
+    quoted = (char *)malloc(len*2+3);
+    if (quoted == NULL) return NULL;
+
+    quoted[0] = '"';
+    for (i=0, j=1; i<len; i++) {
+        if (name[i] == '"') quoted[j++] = '"';
+        quoted[j++] = name[i];
+    }
+    quoted[j++] = '"';
+    quoted[j] = '\0';
+    return quoted;
+}
+
+
 /* the C constructor for cursor objects
  *
  * this function locks the connection to access the cursor list
  * if the keeper argument is given, this function should be called
  *   with a lock on the keeper (to be sure that the keeper does not
  *   get deallocated while we are accessing it)
+ * if name is not NULL the cursor is a server-side cursor and fetches
+ *   FETCHSIZE rows at a time unless arraysize is changed
  */
 cursobject *
-new_psyco_cursobject(connobject *conn, connkeeper *keeper)
+new_psyco_cursobject(connobject *conn, connkeeper *keeper, char *name)
 {
     cursobject *self;
 
@@ -2199,12 +4348,33 @@ new_psyco_cursobject(connobject *conn, connkeeper *keeper)
     self->last_oid = InvalidOid;
     self->isolation_level = conn->isolation_level;
     self->casts = NULL;
+    self->castinfo = NULL;
+    self->datememo = 1;
+    memset(&(self->stats), 0, sizeof(psyco_stats));
     self->notice = NULL;
     self->critical = NULL;
+    self->row = 0;
+    self->ntuples = 0;
+    self->name = NULL;
+    self->pos = 0;
+    self->serverside = 0;
+    self->declared = 0;
+    self->withhold = 0;
+    self->prefetch = 0;
+    self->asyncquery = NULL;
     self->description = Py_None;
     Py_INCREF(Py_None);
     self->status = Py_None;
     Py_INCREF(Py_None);
+
+    if (name) {
+        if (!(self->name = _psyco_curs_quote_name(name))) {
+            self->keeper = NULL;
+            Py_DECREF(self);
+            return (cursobject *)PyErr_NoMemory();
+        }
+        self->arraysize = FETCHSIZE;
+    }
     
     /* get a connection to db */
     if (keeper != NULL) {   
@@ -0,0 +1,43 @@
+# async.py -- example about asynchronous queries
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by the
+# Free Software Foundation; either version 2, or (at your option) any later
+# version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTIBILITY
+# or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+# for more details.
+#
+
+## put in DSN your DSN string
+
+DSN = 'dbname=test user=test'
+
+## don't modify anything below tis line (except for experimenting)
+
+import sys, select, psycopg
+
+if len(sys.argv) > 1:
+    DSN = sys.argv[1]
+
+print "Opening connection using dns:", DSN
+conn = psycopg.connect(DSN, serialize=0)
+
+# every cursor uses its own physical connection, so the two queries below
+# run at the same time on the backend
+curs1 = conn.cursor()
+curs2 = conn.cursor()
+curs1.execute_async("SELECT pg_sleep(1), 'first'")
+curs2.execute_async("SELECT %s, 'second'", (42,))
+
+# wait on the sockets and collect the results as soon as they arrive
+pending = {curs1.fileno():curs1, curs2.fileno():curs2}
+while pending:
+    ready = select.select(pending.keys(), [], [])[0]
+    for fd in ready:
+        curs = pending[fd]
+        if curs.poll():
+            print "Result:", curs.fetchone()[1]
+            del pending[fd]
@@ -0,0 +1,57 @@
+# bulk.py -- example about batched executemany() and copy_records()
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by the
+# Free Software Foundation; either version 2, or (at your option) any later
+# version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTIBILITY
+# or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+# for more details.
+#
+
+## put in DSN your DSN string
+
+DSN = 'dbname=test user=test'
+
+## don't modify anything below tis line (except for experimenting)
+
+import sys, time, psycopg
+
+if len(sys.argv) > 1:
+    DSN = sys.argv[1]
+
+print "Opening connection using dns:", DSN
+conn = psycopg.connect(DSN)
+curs = conn.cursor()
+
+try:
+    curs.execute("CREATE TABLE test_bulk (id int, title text, price float)")
+except:
+    conn.rollback()
+    curs.execute("DROP TABLE test_bulk")
+    curs.execute("CREATE TABLE test_bulk (id int, title text, price float)")
+conn.commit()
+
+rows = [(i, "posting\t%d\n'quoted'" % i, i * 1.5) for i in range(10000)]
+
+# executemany() sends the INSERTs to the backend in batches, one round
+# trip per batch instead of one per row
+t = time.time()
+curs.executemany("INSERT INTO test_bulk VALUES (%s, %s, %s)", rows)
+conn.commit()
+print "executemany(): %.3f seconds" % (time.time() - t)
+
+# copy_records() encodes the rows in the COPY format and streams them to
+# the backend; rows can be any iterable, even a generator
+t = time.time()
+curs.copy_records("test_bulk", ("id", "title", "price"), iter(rows))
+conn.commit()
+print "copy_records(): %.3f seconds, %d rows" % (time.time()-t, curs.rowcount)
+
+curs.execute("SELECT count(*) FROM test_bulk")
+print "Rows in table:", curs.fetchone()[0]
+
+curs.execute("DROP TABLE test_bulk")
+conn.commit()
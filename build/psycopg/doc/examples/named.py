@@ -0,0 +1,48 @@
+# named.py -- example about server-side (named) cursors
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by the
+# Free Software Foundation; either version 2, or (at your option) any later
+# version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTIBILITY
+# or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+# for more details.
+#
+
+## put in DSN your DSN string
+
+DSN = 'dbname=test user=test'
+
+## don't modify anything below tis line (except for experimenting)
+
+import sys, psycopg
+
+if len(sys.argv) > 1:
+    DSN = sys.argv[1]
+
+print "Opening connection using dns:", DSN
+conn = psycopg.connect(DSN)
+
+# a named cursor DECLAREs a cursor on the backend and reads the result
+# arraysize rows at a time, so memory usage does not depend on the
+# number of rows returned by the query
+curs = conn.cursor('big_select')
+curs.arraysize = 100
+curs.execute("SELECT generate_series(1, 1000) AS n")
+print "Description:", curs.description
+
+total = 0
+rows = curs.fetchmany()
+while rows:
+    total += len(rows)
+    rows = curs.fetchmany()
+print "Fetched", total, "rows in batches of", curs.arraysize
+
+# scrolling outside the current batch issues a MOVE on the backend
+curs.scroll(10, mode='absolute')
+print "Row at position 10:", curs.fetchone()
+
+curs.close()
+conn.commit()
@@ -0,0 +1,54 @@
+# prepared.py -- example about out-of-band parameters and prepared statements
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by the
+# Free Software Foundation; either version 2, or (at your option) any later
+# version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTIBILITY
+# or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+# for more details.
+#
+
+## put in DSN your DSN string
+
+DSN = 'dbname=test user=test'
+
+## don't modify anything below tis line (except for experimenting)
+
+import sys, psycopg
+
+if len(sys.argv) > 1:
+    DSN = sys.argv[1]
+
+print "Opening connection using dns:", DSN
+conn = psycopg.connect(DSN)
+curs = conn.cursor()
+
+try:
+    curs.execute("CREATE TABLE test_prep (name text, num int)")
+except:
+    conn.rollback()
+    curs.execute("DROP TABLE test_prep")
+    curs.execute("CREATE TABLE test_prep (name text, num int)")
+conn.commit()
+
+# with prepare=0 the parameters are sent to the backend separately from
+# the query, so strings don't need to be quoted on the client
+curs.execute("INSERT INTO test_prep VALUES (%s, %s)", ("O'Reilly", 1),
+             prepare=0)
+
+# with prepare=1 the statement is prepared on the first execution and
+# reused by the following ones, skipping parse and plan on the backend
+for i in range(2, 100):
+    curs.execute("INSERT INTO test_prep VALUES (%(name)s, %(num)s)",
+                 {'name':'name %d' % i, 'num':i}, prepare=1)
+conn.commit()
+
+curs.execute("SELECT name FROM test_prep WHERE num = %s", (1,), prepare=1)
+print "Name:", curs.fetchone()[0]
+print "Statement cache:", curs.stmtcache()
+
+curs.execute("DROP TABLE test_prep")
+conn.commit()
@@ -0,0 +1,51 @@
+# stats.py -- example about query statistics and the slow query log
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by the
+# Free Software Foundation; either version 2, or (at your option) any later
+# version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTIBILITY
+# or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+# for more details.
+#
+
+## put in DSN your DSN string
+
+DSN = 'dbname=test user=test'
+
+## don't modify anything below tis line (except for experimenting)
+
+import sys, psycopg
+
+if len(sys.argv) > 1:
+    DSN = sys.argv[1]
+
+print "Opening connection using dns:", DSN
+conn = psycopg.connect(DSN)
+
+# statistics are collected only after calling .instrument()
+conn.instrument()
+
+# log every query that takes more than 100 milliseconds
+def slowlog(query, seconds, stats):
+    print "SLOW (%.3f s): %s" % (seconds, query)
+    print "    ", stats
+conn.slowlog(slowlog, 0.1)
+
+curs = conn.cursor()
+curs.execute("SELECT i, i * 2, 'row ' || i FROM generate_series(1, 10000) i")
+rows = curs.fetchall()
+print "Statistics of the last query:"
+for k, v in curs.stats().items():
+    print "    %-14s %s" % (k, v)
+
+curs.execute("SELECT pg_sleep(0.2)")
+
+print "Statistics of the connection:"
+for k, v in conn.stats().items():
+    print "    %-14s %s" % (k, v)
+
+# stop collecting statistics
+conn.instrument(0)
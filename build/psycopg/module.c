@@ -50,24 +50,36 @@ static char psyco_connect__doc__[] =
 "physical connections to posgresql (default is "MACRO_STR(MAXCONN)"), "
 "'minconn' is the\n"
 "minimum number of physical connections will be available for reuse\n"
-"(must be minconn < maxconn).";
+"(must be minconn < maxconn). minconn connections are opened immediately.\n"
+"'timeout' is the number of seconds a new cursor waits for a free\n"
+"connection when maxconn are in use (0 to fail immediately) and\n"
+"'idletime' the number of seconds after which connections exceeding\n"
+"minconn are closed if unused.\n"
+"\n"
+"Physical connections are opened releasing the interpreter lock but the\n"
+"calling thread waits until they are ready or the connect_timeout of the\n"
+"dsn expires: an event loop should call connect() from a worker thread\n"
+"and use cursor.execute_async() and cursor.poll() for the queries.";
 
 static PyObject *
 psyco_connect(PyObject *self, PyObject *args, PyObject *keywds)
 {
     PyObject *conn;
     int maxconn=MAXCONN, minconn=MINCONN, serialize=1, idsn=-1;
+    int timeout=POOLTIMEOUT, idletime=POOLIDLE;
     char *dsn=NULL, *database=NULL, *user=NULL, *password=NULL,
          *host=NULL, *port=NULL, *sslmode=NULL;
     
     static char *kwlist[] = {"dsn", "database", "host", "port",
                              "user", "password", "sslmode", 
-                             "maxconn", "minconn", "serialize", NULL};
+                             "maxconn", "minconn", "serialize",
+                             "timeout", "idletime", NULL};
 
-    if (!PyArg_ParseTupleAndKeywords(args, keywds, "|sssssssiii", kwlist,
+    if (!PyArg_ParseTupleAndKeywords(args, keywds, "|sssssssiiiii", kwlist,
                                      &dsn, &database, &host, &port,
                                      &user, &password, &sslmode,
-                                     &maxconn, &minconn, &serialize)) {
+                                     &maxconn, &minconn, &serialize,
+                                     &timeout, &idletime)) {
         return NULL;
     }
 
@@ -135,8 +147,14 @@ psyco_connect(PyObject *self, PyObject *args, PyObject *keywds)
         PyErr_SetString(InterfaceError, "wrong value for serialize");
         return NULL;
     }
+
+    if (timeout < 0 || idletime < 0) {
+        PyErr_SetString(InterfaceError, "wrong value for timeout/idletime");
+        return NULL;
+    }
     
-    conn = (PyObject *)new_psyco_connobject(dsn, maxconn, minconn, serialize);
+    conn = (PyObject *)new_psyco_connobject(dsn, maxconn, minconn, serialize,
+                                               timeout, idletime);
     if (idsn != -1) free(dsn);
     
     return conn;
@@ -34,6 +34,7 @@
 #include <stdio.h>
 #include <libpq-fe.h>
 #include <time.h>
+#include <errno.h>
 #ifndef _WIN32
 #include <pthread.h>
 #else
@@ -49,6 +50,30 @@ static int pthread_mutex_init(pthread_mutex_t *mutex, void* temp)
   *mutex=CreateMutex(NULL, FALSE, NULL);
   return 0;
 }
+
+#define pthread_cond_t HANDLE
+#define pthread_cond_signal(object) SetEvent(object)
+#define pthread_cond_destroy(ref) (CloseHandle(ref))
+
+static int pthread_cond_init(pthread_cond_t *cond, void* temp)
+{
+  *cond=CreateEvent(NULL, FALSE, FALSE, NULL);
+  return 0;
+}
+
+static int pthread_cond_timedwait(pthread_cond_t *cond,
+                                  pthread_mutex_t *mutex,
+                                  const struct timespec *abstime)
+{
+  DWORD rv, ms = 0;
+  time_t now = time(NULL);
+
+  if (abstime->tv_sec > now) ms = (DWORD)(abstime->tv_sec - now) * 1000;
+  ReleaseMutex(*mutex);
+  rv = WaitForSingleObject(*cond, ms);
+  WaitForSingleObject(*mutex, INFINITE);
+  return rv == WAIT_TIMEOUT ? ETIMEDOUT : 0;
+}
 #define inline
 
 #endif
@@ -61,6 +86,11 @@ static int pthread_mutex_init(pthread_mutex_t *mutex, void* temp)
 #define PyObject_Del PyMem_DEL
 #endif
 
+/**** Py_ssize_t introduced in 2.5 ****/
+#if PY_VERSION_HEX < 0x02050000
+typedef int Py_ssize_t;
+#endif
+
 /**** PyObject_TypeCheck introduced in 2.2 ****/
 #ifndef PyObject_TypeCheck
 #define PyObject_TypeCheck(o, t) ((o)->ob_type == (t))
@@ -75,6 +105,13 @@ static int pthread_mutex_init(pthread_mutex_t *mutex, void* temp)
 /**** constants of the module ****/
 #define MAXCONN 64
 #define MINCONN 8
+#define FETCHSIZE 1000
+#define MAXSTMTS 64
+#define BATCHSIZE 100
+#define COPYBUFSIZE 65536
+#define POOLTIMEOUT 30
+#define POOLIDLE 300
+#define POOLCHECK 30
 #define MACRO_STR(MACRO) "\"MACRO\""
 
 
@@ -118,17 +155,58 @@ PyObject *Error, *Warning, *InterfaceError,
     *IntegrityError, *DataError, *NotSupportedError;
 
 
+/**** the prepared statements cache entry: every connection keeper keeps
+      a list of the statements prepared on its PGconn ****/
+
+typedef struct _stmtentry {
+    struct _stmtentry *next;
+    char  *operation;     /* the query passed to execute(), used as key */
+    long   hash;          /* hash of operation, to speed up lookups */
+    char   name[32];      /* name of the statement on the backend */
+} stmtentry;
+
+
 /**** the connection keeper object, used by cursors and connections to
       access PGconnection objects ****/
 
-typedef struct {
+typedef struct _connkeeper {
     PGconn          *pgconn;
     pthread_mutex_t  lock;
     int              refcnt;
     int              status;
+
+    /* prepared statements, most recently used first */
+    stmtentry       *stmts;
+    int              nstmts;
+    int              serial;    /* used to name new statements */
+    long int         hits;      /* statement cache hits and misses */
+    long int         misses;
+
+    /* the cursor that sent an asynchronous query still running on the
+       connection, or NULL */
+    struct _cursobject *async;
+
+    /* next idle keeper in the connection pool and when it was released */
+    struct _connkeeper *next;
+    time_t           idle;
 } connkeeper;
 
 
+/**** query statistics, collected by cursors and connections when the
+      instrumentation is enabled with connection.instrument(); all the times
+      are in seconds ****/
+
+typedef struct {
+    long int queries;     /* queries executed */
+    double exectime;      /* waiting for the backend to execute them */
+    double describetime;  /* building descriptions and casting functions */
+    double fetchtime;     /* converting rows to python objects */
+    double lockwait;      /* waiting for the keeper locks */
+    long int rows;        /* rows converted */
+    long int bytes;       /* bytes of data converted */
+} psyco_stats;
+
+
 /**** the connection object ****/
 
 /* forward declaration of the cursor object */
@@ -137,7 +215,6 @@ typedef struct _cursobject cursobject;
 typedef struct {
     PyObject_HEAD
     PyObject *cursors;    /* a sequence of cursors on this connection */
-    PyObject *avail_conn; /* a sequence of avaliable db connections */
     pthread_mutex_t lock; /* the global connection lock */
     cursobject *stdmanager; /* manager cursor */
     char *dsn;
@@ -146,10 +223,35 @@ typedef struct {
     int minconn;          /* minimum number of open connections */
     int isolation_level;  /* isolation level */
     int serialize;        /* serialize cursors? */
+
+    /* the pool of physical connections, protected by poollock: idle
+       keepers are kept most recently used first */
+    pthread_mutex_t poollock;
+    pthread_cond_t poolcond; /* signaled when a connection is released */
+    connkeeper *avail;    /* idle keepers */
+    int navail;           /* number of idle keepers */
+    int nopen;            /* open keepers, both idle and in use */
+    int timeout;          /* seconds to wait for a free connection */
+    int idletime;         /* seconds before closing an idle connection */
+    long int waits;       /* pool statistics */
+    long int creates;
+    long int destroys;
+
+    /* instrumentation: the totals of all the cursors plus the time spent
+       waiting for the pool and the slow query log; updated only with the
+       global interpreter lock held */
+    int instrument;       /* true if statistics are collected */
+    psyco_stats stats;
+    long int acquires;    /* physical connections obtained from the pool */
+    double acquiretime;   /* total and worst time needed to obtain them */
+    double acquiremax;
+    PyObject *slowlog;    /* called for queries slower than slowtime */
+    double slowtime;
+    long int slow;        /* number of calls to slowlog */
 } connobject;
 
 connobject *new_psyco_connobject(char *dsn, int maxconn, int minconn,
-                                 int serialize);
+                                 int serialize, int timeout, int idletime);
 
 
 /**** the cursor object ****/
@@ -174,6 +276,10 @@ struct _cursobject {
     /* the row counter for fetch*() */
     long int row;
 
+    /* number of rows in the current result; the same as rowcount for normal
+       cursors, the size of the last FETCH batch for named cursors */
+    long int ntuples;
+
     /* number of columns fetched from the db */
     long int columns;
 
@@ -185,6 +291,13 @@ struct _cursobject {
     /* an array (tuple) of typecast functions */
     PyObject *casts;
 
+    /* the same functions resolved to C pointers, one for each column */
+    psyco_CastInfo *castinfo;
+
+    /* if true date and time columns memoize the objects built from their
+       values, so that repeated values are parsed only once per result */
+    int datememo;
+
     /* last message from the server after an execute */
     PyObject *status;
     
@@ -199,9 +312,29 @@ struct _cursobject {
 
     /* a critical error, remember to cleanup */
     char *critical;
+
+    /* server-side (named) cursor support: the quoted cursor name (NULL for
+       normal cursors), rows consumed from the backend so far and flags
+       telling if the current result is read from the server-side cursor
+       (statements not returning rows are executed normally), if the cursor
+       is DECLAREd, if it was declared WITH HOLD and if a FETCH was sent and
+       its result is still pending */
+    char *name;
+    long int pos;
+    int serverside;
+    int declared;
+    int withhold;
+    int prefetch;
+
+    /* the query sent by execute_async(), until its result is collected */
+    char *asyncquery;
+
+    /* statistics about the last query, if the connection is instrumented */
+    psyco_stats stats;
 };
 
-cursobject *new_psyco_cursobject(connobject *conn, connkeeper *keeper);
+cursobject *new_psyco_cursobject(connobject *conn, connkeeper *keeper,
+                                 char *name);
 
 /**** function type used in execute callbacks ****/
 typedef PyObject *(*_psyco_curs_execute_callback)(cursobject *s, PyObject *o);
@@ -220,6 +353,15 @@ extern int begin_pgconn(cursobject *self);
 /**** other globally visible functions ****/
 extern void curs_switch_isolation_level(cursobject *self, long int level);
 extern connkeeper *alloc_keeper(connobject *conn);
+extern void free_keeper(connkeeper *keeper);
+
+/**** connection pool functions ****/
+extern connkeeper *pool_get(connobject *conn);
+extern void pool_put(connobject *conn, connkeeper *keeper);
+extern void pool_discard(connobject *conn, connkeeper *keeper);
+
+/**** instrumentation functions ****/
+extern double psyco_gettime(void);
 
 
 /**** some usefull macros ****/
@@ -240,6 +382,14 @@ extern connkeeper *alloc_keeper(connobject *conn);
   PyErr_SetString(Error,"serialized connection: cannot commit on this cursor"); \
                                  return NULL; }
 
+/* for methods that can't run while another cursor's asynchronous query is
+   in progress on the same connection */
+#define EXC_IFASYNC(self) if ((self)->keeper && (self)->keeper->async \
+                              && (self)->keeper->async != (self)) { \
+  PyErr_SetString(ProgrammingError, \
+                  "an asynchronous query is in progress on this connection"); \
+                              return NULL; }
+
 /* check for critical errors */
 #define EXC_IFCRITICAL(self) if ((self)->critical) \
                                   return pgconn_resolve_critical(self)
@@ -0,0 +1,176 @@
+# this script is a micro-benchmark for the psycopg C extension. it runs
+# against a local database (the DSN is the first argument) and times the
+# fetch path at different widths and row counts, executemany(), COPY, the
+# typecasting of every builtin type and the quoting functions. every test
+# is repeated and the best run is reported, together with the split of the
+# time given by the connection statistics (see connection.instrument().)
+#
+# usage: bench.py DSN [test ...]   (tests: fetch cast executemany copy quote)
+#
+# the data is generated by the backend with generate_series() or by this
+# script from constants, so two runs on the same machine are comparable.
+
+import sys, time, StringIO
+import psycopg
+
+if len(sys.argv) > 1:
+    DSN = sys.argv[1]
+else:
+    sys.stderr.write("Error: missing connection DSN\n")
+    sys.exit(1)
+
+TESTS = sys.argv[2:] or ['fetch', 'cast', 'executemany', 'copy', 'quote']
+REPEAT = 5
+
+
+o = psycopg.connect(DSN)
+o.instrument()
+c = o.cursor()
+
+
+## helpers
+
+def delta(before, after):
+    d = {}
+    for k in after.keys():
+        d[k] = after[k] - before[k]
+    return d
+
+def bench(name, rows, func, *args):
+    """run func(*args) REPEAT times and print the best run"""
+    best = None
+    for i in range(REPEAT):
+        before = o.stats()
+        t = time.time()
+        func(*args)
+        t = time.time() - t
+        if best is None or t < best[0]:
+            best = (t, delta(before, o.stats()))
+    t, s = best
+    if t > 0: rate = rows / t
+    else: rate = 0.0
+    print "%-28s %8d %9.2f ms %11.0f rows/s  exec %7.2f  desc %5.2f  " \
+          "fetch %7.2f  lock %5.2f ms  %9d bytes" % \
+          (name, rows, t*1000.0, rate, s['exectime']*1000.0,
+           s['describetime']*1000.0, s['fetchtime']*1000.0,
+           s['lockwait']*1000.0, s['bytes'])
+
+def select(query):
+    c.execute(query)
+    c.fetchall()
+
+def columns(width, expr):
+    return ", ".join([expr % i for i in range(width)])
+
+
+## fetch: the cost of materializing rows, by width and row count
+
+def test_fetch():
+    for width in (1, 10, 50):
+        for rows in (100, 10000, 100000):
+            query = "SELECT %s FROM generate_series(1, %d) AS i" % \
+                    (columns(width, "i + %d"), rows)
+            bench("fetch %dx%d" % (rows, width), rows, select, query)
+    c.execute("SELECT i, 'row ' || i FROM generate_series(1, 10000) AS i")
+    bench("fetchone 10000x2", 10000, fetchone, 10000)
+    bench("dictfetchall 10000x2", 10000, dictfetchall,
+          "SELECT i, 'row ' || i AS s FROM generate_series(1, 10000) AS i")
+
+def fetchone(n):
+    c.scroll(0, 'absolute')
+    for i in range(n): c.fetchone()
+
+def dictfetchall(query):
+    c.execute(query)
+    c.dictfetchall()
+
+
+## cast: the typecasting functions of the builtin types
+
+CASTS = (('int4', "i"),
+         ('int8', "i::int8 * 1000000"),
+         ('float8', "i / 7.0::float8"),
+         ('numeric', "i / 7.0::numeric(20,6)"),
+         ('bool', "i % 2 = 0"),
+         ('text', "'some text for row ' || i"),
+         ('date', "'2005-01-01'::date + i % 365"),
+         ('timestamp', "'2005-01-01'::timestamp + i * interval '1 minute'"),
+         ('timestamp (repeated)',
+          "'2005-01-01'::timestamp + (i % 10) * interval '1 day'"),
+         ('timestamptz', "'2005-01-01 00:00+02'::timestamptz + i * "
+                         "interval '1 second'"),
+         ('time', "'00:00'::time + i * interval '1 second'"),
+         ('interval', "i * interval '1 minute 1.5 seconds'"),
+         ('bytea', "decode(repeat(md5(i::text), 4), 'hex')"))
+
+def test_cast():
+    rows = 50000
+    for name, expr in CASTS:
+        query = "SELECT %s FROM generate_series(1, %d) AS i" % \
+                (columns(4, "(" + expr + ") AS c%d"), rows)
+        bench("cast %s" % name, rows * 4, select, query)
+
+
+## executemany: batched and prepared inserts
+
+def executemany(rows, prepare):
+    c.execute("TRUNCATE bench_many")
+    if prepare is None:
+        c.executemany("INSERT INTO bench_many VALUES (%s, %s, %s)", rows)
+    else:
+        c.executemany("INSERT INTO bench_many VALUES (%s, %s, %s)", rows,
+                      prepare)
+    o.commit()
+
+def test_executemany():
+    c.execute("CREATE TEMP TABLE bench_many (i int4, f float8, s text)")
+    o.commit()
+    rows = [(i, i / 7.0, "row %d with 'quotes'" % i) for i in range(10000)]
+    bench("executemany", len(rows), executemany, rows, None)
+    bench("executemany prepared", len(rows), executemany, rows, 1)
+
+
+## copy: COPY FROM and COPY TO throughput
+
+def copy_from(data):
+    c.execute("TRUNCATE bench_copy")
+    c.copy_from(StringIO.StringIO(data), 'bench_copy')
+    o.commit()
+
+def copy_to():
+    c.copy_to(StringIO.StringIO(), 'bench_copy')
+
+def copy_records(rows):
+    c.execute("TRUNCATE bench_copy")
+    c.copy_records('bench_copy', None, rows)
+    o.commit()
+
+def test_copy():
+    c.execute("CREATE TEMP TABLE bench_copy (i int4, f float8, s text)")
+    o.commit()
+    rows = [(i, i / 7.0, "row %d\twith\\specials" % i) for i in range(100000)]
+    data = "".join(["%d\t%r\trow %d\n" % (i, f, i) for i, f, s in rows])
+    bench("copy_from", len(rows), copy_from, data)
+    bench("copy_to", len(rows), copy_to)
+    if hasattr(c, 'copy_records'):
+        bench("copy_records", len(rows), copy_records, rows)
+
+
+## quote: the quoting functions used to build queries (no backend)
+
+def quote(func, values, n):
+    for i in range(n):
+        for v in values: str(func(v))
+
+def test_quote():
+    strings = ["plain", "it's quoted", "back\\slash", "x" * 1000]
+    binary = ["".join(map(chr, range(256))) * 4, "\0\1\2\\'" * 100]
+    bench("QuotedString", 10000 * len(strings), quote,
+          psycopg.QuotedString, strings, 10000)
+    bench("Binary", 10000 * len(binary), quote, psycopg.Binary, binary, 10000)
+
+
+for t in TESTS:
+    globals()['test_' + t]()
+
+o.rollback()
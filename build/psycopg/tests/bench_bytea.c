@@ -0,0 +1,346 @@
+/*
+ * bench_bytea.c - compare the old and new bytea kernels
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTIBILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/*
+ * the old kernels are the byte-at-a-time loops of psycopg 1.1.21
+ * (new_psyco_bufferobject() and psyco_BINARY_cast()), the new ones are
+ * those of bytea.h, used by the module, with the python strings replaced by
+ * malloc()ed buffers.
+ *
+ * every kernel is first checked against the others (the old and new
+ * escaping must produce the same bytes and every decoder must give back
+ * the original data), then timed on binary, text-like and escape-heavy
+ * data; the best of REPEAT runs is printed.
+ *
+ * usage: make bench-bytea  (or: cc -O2 -I. -o tests/bench_bytea
+ *        tests/bench_bytea.c)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define PSYCO_BYTEA_ENCODE
+#define PSYCO_BYTEA_DECODE
+#include "bytea.h"
+
+#define REPEAT 5
+
+/**** old kernels (psycopg 1.1.21) ****/
+
+static unsigned char *
+old_escape(const unsigned char *original, int len, int *outlen)
+{
+    unsigned char *quoted, *chptr, *newptr;
+    int i, space = len + 2, new_space;
+
+    quoted = (unsigned char*)calloc(space, sizeof(char));
+    if (quoted == NULL) return NULL;
+
+    chptr = quoted;
+    *chptr = '\'';
+    chptr++;
+
+    for (i=0; i < len; i++) {
+        if (chptr - quoted > space - 6) {
+            new_space  =  space * ((space) / (i + 1)) + 2 + 6;
+            if (new_space - space < 1024) space += 1024;
+            else space = new_space;
+            newptr = (unsigned char *)realloc(quoted, space);
+            if (newptr == NULL) {
+                free(quoted);
+                return NULL;
+            }
+            chptr = newptr + (chptr - quoted);
+            quoted = newptr;
+        }
+        if (original[i]) {
+            if (original[i] >= ' ' && original[i] <= '~') {
+                if (original[i] == '\'') {
+                    *chptr = '\\';
+                    chptr++;
+                    *chptr = '\'';
+                    chptr++;
+                }
+                else if (original[i] == '\\') {
+                    memcpy(chptr, "\\\\\\\\", 4);
+                    chptr += 4;
+                }
+                else {
+                    *chptr = original[i];
+                    chptr++;
+                }
+            }
+            else {
+                unsigned char c;
+
+                *chptr++ = '\\';
+                *chptr++ = '\\';
+                c = original[i];
+                *chptr = ((c >> 6) & 0x07) + 0x30;
+                chptr++;
+                *chptr = ((c >> 3) & 0x07) + 0x30;
+                chptr++;
+                *chptr = (c & 0x07) + 0x30;
+                chptr++;
+            }
+        }
+        else {
+            memcpy(chptr, "\\\\000", 5);
+            chptr += 5;
+        }
+    }
+    *chptr = '\'';
+    *outlen = chptr - quoted + 1;
+    return quoted;
+}
+
+static char *
+old_decode(const char *str, int *outlen)
+{
+    char *dstptr, *dststr;
+    int len, i;
+
+    len = strlen(str);
+    dststr = (char*)calloc(len, sizeof(char));
+    dstptr = dststr;
+
+    for (i = 0; i < len; i++) {
+        if (str[i] == '\\') {
+            if ( ++i < len) {
+                if (str[i] == '\\') {
+                    *dstptr = '\\';
+                }
+                else {
+                    *dstptr = 0;
+                    *dstptr |= (str[i++] & 7) << 6;
+                    *dstptr |= (str[i++] & 7) << 3;
+                    *dstptr |= (str[i] & 7);
+                }
+            }
+        }
+        else {
+            *dstptr = str[i];
+        }
+        dstptr++;
+    }
+    *outlen = dstptr - dststr;
+    return dststr;
+}
+
+
+/**** new kernels (bytea.h) ****/
+
+/* new_psyco_bufferobject() without the python string */
+static unsigned char *
+new_escape(const unsigned char *original, long len, int hex, long *outlen)
+{
+    unsigned char *quoted, *chptr;
+    long space;
+
+    if (hex)
+        space = 2*len + 5;
+    else
+        space = _psyco_bytea_escapelen(original, len) + 2;
+
+    if (!(quoted = (unsigned char *)malloc(space + ESCAPESLACK)))
+        return NULL;
+
+    chptr = quoted;
+    *chptr++ = '\'';
+    if (hex) {
+        memcpy(chptr, "\\\\x", 3);
+        chptr = _psyco_bytea_hex(chptr + 3, original, len);
+    }
+    else {
+        chptr = _psyco_bytea_escape(chptr, original, len);
+    }
+    *chptr = '\'';
+    *outlen = space;
+    return quoted;
+}
+
+/* psyco_bytea_decode() without the python string; NULL on bad hex */
+static unsigned char *
+new_decode(const char *s, long len, long *outlen)
+{
+    unsigned char *dst;
+    long n;
+
+    if (len >= 2 && s[0] == '\\' && s[1] == 'x') {
+        n = (len - 2) / 2;
+        if (!(dst = (unsigned char *)malloc(n + 1))) return NULL;
+        if (_psyco_bytea_unhex(dst, (const unsigned char *)s + 2, n)
+            || (len & 1)) {
+            free(dst);
+            return NULL;
+        }
+        *outlen = n;
+        return dst;
+    }
+
+    if (!(dst = (unsigned char *)malloc(len + 1))) return NULL;
+    *outlen = _psyco_bytea_unescape(dst, s, len) - dst;
+    return dst;
+}
+
+
+/**** checks and timings ****/
+
+static int failed = 0;
+
+static void
+fail(const char *what, const char *data, long len)
+{
+    printf("FAILED %s (%s data, %ld bytes)\n", what, data, len);
+    failed = 1;
+}
+
+static double
+now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* the server sends the escape format with single backslashes and without
+   quotes: turn a quoted literal into what the decoders get from libpq */
+static char *
+literal_to_value(const unsigned char *lit, long len, long *outlen)
+{
+    char *val = (char *)malloc(len + 1), *d = val;
+    long i;
+
+    for (i = 1; i < len - 1; i++) {
+        if (lit[i] == '\\' && lit[i+1] == '\\') i++;
+        else if (lit[i] == '\\' && lit[i+1] == '\'') i++;
+        *d++ = lit[i];
+    }
+    *d = '\0';
+    *outlen = d - val;
+    return val;
+}
+
+static void
+check(const char *name, const unsigned char *data, long len)
+{
+    unsigned char *oe, *ne, *nh, *nd;
+    char *ov, *nv, *od;
+    int olen, odlen;
+    long nlen, nhlen, ovlen, nvlen, ndlen;
+
+    oe = old_escape(data, (int)len, &olen);
+    ne = new_escape(data, len, 0, &nlen);
+    nh = new_escape(data, len, 1, &nhlen);
+    if (olen != nlen || memcmp(oe, ne, nlen))
+        fail("escape: old and new differ", name, len);
+
+    ov = literal_to_value(oe, olen, &ovlen);
+    nv = literal_to_value(nh, nhlen, &nvlen);
+
+    /* the old decoder stops at the first NUL, always there for escapes */
+    od = old_decode(ov, &odlen);
+    if (odlen != len || memcmp(od, data, len))
+        fail("escape: old round trip", name, len);
+    nd = new_decode(ov, ovlen, &ndlen);
+    if (!nd || ndlen != len || memcmp(nd, data, len))
+        fail("escape: new round trip", name, len);
+    free(nd);
+    nd = new_decode(nv, nvlen, &ndlen);
+    if (!nd || ndlen != len || memcmp(nd, data, len))
+        fail("hex: new round trip", name, len);
+
+    free(oe); free(ne); free(nh); free(ov); free(nv); free(od); free(nd);
+}
+
+static void
+bench(const char *name, const unsigned char *data, long len)
+{
+    unsigned char *lit;
+    char *esc, *hex, *out;
+    double t, best[6];
+    long l, esclen, hexlen;
+    int i, k, il;
+
+    lit = new_escape(data, len, 0, &l);
+    esc = literal_to_value(lit, l, &esclen);
+    free(lit);
+    lit = new_escape(data, len, 1, &l);
+    hex = literal_to_value(lit, l, &hexlen);
+    free(lit);
+
+    for (k = 0; k < 6; k++) best[k] = 1e9;
+    for (i = 0; i < REPEAT; i++) {
+        t = now(); free(old_escape(data, (int)len, &il));
+        if ((t = now() - t) < best[0]) best[0] = t;
+        t = now(); free(new_escape(data, len, 0, &l));
+        if ((t = now() - t) < best[1]) best[1] = t;
+        t = now(); free(new_escape(data, len, 1, &l));
+        if ((t = now() - t) < best[2]) best[2] = t;
+        t = now(); free(old_decode(esc, &il));
+        if ((t = now() - t) < best[3]) best[3] = t;
+        t = now(); free(new_decode(esc, esclen, &l));
+        if ((t = now() - t) < best[4]) best[4] = t;
+        t = now(); out = (char *)new_decode(hex, hexlen, &l); free(out);
+        if ((t = now() - t) < best[5]) best[5] = t;
+    }
+
+    printf("%-8s encode escape: old %8.2f ms  new %8.2f ms (x%5.1f)"
+           "   hex %8.2f ms\n", name, best[0]*1000.0, best[1]*1000.0,
+           best[0] / best[1], best[2]*1000.0);
+    printf("%-8s decode escape: old %8.2f ms  new %8.2f ms (x%5.1f)"
+           "   hex %8.2f ms\n", name, best[3]*1000.0, best[4]*1000.0,
+           best[3] / best[4], best[5]*1000.0);
+    free(esc); free(hex);
+}
+
+int
+main(int argc, char **argv)
+{
+    static const char *names[] = {"binary", "text", "quotes"};
+    unsigned char *data;
+    long size = argc > 1 ? atol(argv[1]) : 8*1024*1024, len, i;
+    int k;
+
+    _psyco_bytea_init();
+    if (!(data = (unsigned char *)malloc(size))) return 1;
+
+    for (k = 0; k < 3; k++) {
+        srand(42);
+        for (i = 0; i < size; i++) {
+            if (k == 0)      data[i] = rand() & 0xff;
+            else if (k == 1) data[i] = ' ' + rand() % 95;
+            else             data[i] = "\\'a\0"[rand() & 3];
+        }
+        /* every length up to a few words, to reach all the tails */
+        for (len = 0; len < 64; len++) check(names[k], data, len);
+        check(names[k], data, 100000);
+    }
+    if (failed) return 1;
+
+    printf("%ld bytes, best of %d runs\n", size, REPEAT);
+    for (k = 0; k < 3; k++) {
+        srand(42);
+        for (i = 0; i < size; i++) {
+            if (k == 0)      data[i] = rand() & 0xff;
+            else if (k == 1) data[i] = ' ' + rand() % 95;
+            else             data[i] = "\\'a\0"[rand() & 3];
+        }
+        bench(names[k], data, size);
+    }
+    free(data);
+    return 0;
+}
@@ -0,0 +1,92 @@
+# check_async.py -- regression test for the asynchronous queries (see
+# cursor.execute_async() and cursor.poll()) and for the connect_timeout
+#
+# usage: check_async.py DSN  (see checkutil.py)
+
+import os, time, select, socket
+import psycopg
+from checkutil import DSN, check, raises, done
+
+def wait(curs):
+    """wait on the socket and poll() until the result is available"""
+    while not curs.poll():
+        select.select([curs.fileno()], [], [], 10.0)
+
+
+o = psycopg.connect(DSN)
+c = o.cursor()
+d = o.cursor()
+
+
+## execute_async() and poll() to completion
+
+c.execute_async("SELECT 42 FROM pg_sleep(0.2)")
+check("poll while busy", c.poll(), 0)
+raises("execute while async", psycopg.ProgrammingError, d.execute, "SELECT 1")
+wait(c)
+check("async result", c.fetchall(), [(42,)])
+check("async rowcount", c.rowcount, 1)
+
+## the last result of a multi-statement query is kept
+
+c.execute_async("SELECT 1; SELECT 2, 3")
+wait(c)
+check("async multi-statement", c.fetchall(), [(2, 3)])
+
+## isready() becomes true without poll()ing
+
+c.execute_async("SELECT 'ready'")
+for i in range(100):
+    if c.isready(): break
+    select.select([c.fileno()], [], [], 0.1)
+check("isready", c.isready(), 1)
+wait(c)
+check("isready result", c.fetchall(), [('ready',)])
+
+## poll() without a query in progress
+
+raises("poll without query", psycopg.ProgrammingError, c.poll)
+
+## errors are raised by poll() and the connection is still usable
+
+c.execute_async("SELECT 1/0")
+err = raises("async error", psycopg.Error, wait, c)
+if err:
+    check("async error message", "division by zero" in str(err), True)
+o.rollback()
+c.execute("SELECT 'after'")
+check("after async error", c.fetchall(), [('after',)])
+
+## a multi-statement query stops at the first error
+
+c.execute_async("SELECT 1; SELECT 1/0; SELECT 3")
+raises("async multi-statement error", psycopg.Error, wait, c)
+o.rollback()
+o.close()
+
+
+## connect_timeout: a server accepting connections but never answering
+
+def timeout(name, dsn, port):
+    t = time.time()
+    err = raises(name, psycopg.OperationalError, psycopg.connect, dsn % port)
+    if err:
+        check(name + " message", "timeout expired" in str(err), True)
+    check(name + " elapsed", 1.5 < time.time() - t < 10, True)
+
+s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+s.bind(("127.0.0.1", 0))
+s.listen(5)
+port = s.getsockname()[1]
+
+# the value is the one libpq uses, whatever the form of the dsn
+timeout("connect_timeout", "host=127.0.0.1 port=%d dbname=x connect_timeout=2",
+        port)
+timeout("connect_timeout in a URI",
+        "postgresql://127.0.0.1:%d/x?connect_timeout=2", port)
+os.environ["PGCONNECT_TIMEOUT"] = "2"
+timeout("PGCONNECT_TIMEOUT", "host=127.0.0.1 port=%d dbname=x", port)
+del os.environ["PGCONNECT_TIMEOUT"]
+s.close()
+
+done()
@@ -0,0 +1,97 @@
+# check_bulk.py -- regression test for executemany(), copy_records() and
+# copy_from()
+#
+# usage: check_bulk.py DSN  (see checkutil.py)
+
+import array
+import psycopg
+from checkutil import DSN, check, raises, done
+
+def rows(curs, table):
+    curs.execute("SELECT * FROM %s ORDER BY 1" % table)
+    return curs.fetchall()
+
+
+o = psycopg.connect(DSN)
+c = o.cursor()
+c.execute("CREATE TEMP TABLE bulk_test (i int4, s text)")
+o.commit()
+
+
+## executemany() in a transaction: more than one batch of statements
+
+data = [(i, "row %d with 'quotes' and \\ backslash" % i) for i in range(250)]
+c.executemany("INSERT INTO bulk_test VALUES (%s, %s)", data)
+o.commit()
+check("executemany batches", rows(c, "bulk_test"), data)
+
+## a trailing comment must not swallow the following statements
+
+c.execute("DELETE FROM bulk_test")
+c.executemany("INSERT INTO bulk_test VALUES (%s, %s) -- comment", data[:10])
+o.commit()
+check("executemany with comment", rows(c, "bulk_test"), data[:10])
+
+## an error reports only the failing statement
+
+c.execute("DELETE FROM bulk_test")
+o.commit()
+err = raises("executemany error", psycopg.ProgrammingError, c.executemany,
+             "INSERT INTO bulk_test VALUES (%s, %s)",
+             [(1, 'a'), ('x', 'failing'), (3, 'c')])
+if err:
+    msg = str(err)
+    check("executemany error statement", "'failing'" in msg, True)
+    check("executemany error length", "'a'" in msg or "'c'" in msg, False)
+o.rollback()
+
+## in autocommit mode every statement is committed on its own
+
+o.autocommit()
+c.execute("DELETE FROM bulk_test")
+raises("executemany autocommit error", psycopg.ProgrammingError,
+       c.executemany, "INSERT INTO bulk_test VALUES (%s, %s)",
+       [(1, 'a'), (2, 'b'), ('x', 'failing'), (4, 'd')])
+check("executemany autocommit", rows(c, "bulk_test"), [(1, 'a'), (2, 'b')])
+o.autocommit(0)
+
+
+## copy_records(): special characters and NULLs survive a round trip
+
+c.execute("DELETE FROM bulk_test")
+data = [(1, "tab\there"),
+        (2, "newline\nhere"),
+        (3, "back\\slash"),
+        (4, "carriage\rreturn"),
+        (5, None),
+        (6, ""),
+        (7, "\\N"),
+        (8, "all\t\n\\\r of them")]
+c.copy_records("bulk_test", None, data)
+check("copy_records rowcount", c.rowcount, len(data))
+check("copy_records round trip", rows(c, "bulk_test"), data)
+
+c.execute("DELETE FROM bulk_test")
+c.copy_records("bulk_test", ("s", "i"), [(s, i) for i, s in data])
+check("copy_records columns", rows(c, "bulk_test"), data)
+
+raises("copy_records wrong row", psycopg.ProgrammingError,
+       c.copy_records, "bulk_test", None, [(1, "a"), (2,)])
+o.rollback()
+
+
+## copy_from(): strings and other buffer objects larger than a chunk
+
+data = [(i, "row %d" % i) for i in range(20000)]
+text = "".join(["%d\t%s\n" % r for r in data])
+
+c.execute("DELETE FROM bulk_test")
+c.copy_from(text, "bulk_test")
+check("copy_from string", rows(c, "bulk_test"), data)
+
+c.execute("DELETE FROM bulk_test")
+c.copy_from(array.array('c', text), "bulk_test")
+check("copy_from buffer", rows(c, "bulk_test"), data)
+o.rollback()
+
+done()
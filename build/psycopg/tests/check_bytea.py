@@ -0,0 +1,82 @@
+# check_bytea.py -- regression test for bytea values: data quoted by
+# Binary() in the escape and hex formats is sent to the backend and read back
+# with bytea_output set to escape and hex (the latter only if the backend has
+# it, PostgreSQL 9.0 and later)
+#
+# usage: check_bytea.py DSN  (see checkutil.py)
+
+import random
+import psycopg
+from checkutil import DSN, check, done
+
+try:
+    from hashlib import md5
+except ImportError:
+    from md5 import new as md5
+
+def setting(curs, name, value):
+    """set a backend parameter, return false if the backend lacks it"""
+    try:
+        curs.execute("SET %s TO %s" % (name, value))
+    except psycopg.Error:
+        o.rollback()
+        return 0
+    return 1
+
+
+random.seed(42)
+DATA = [("empty", ""),
+        ("nul", "\0"),
+        ("specials", "\0\\'\"\t\n\r\x7f\x80\xff"),
+        ("backslashes", "\\" * 17),
+        ("quotes", "'" * 17),
+        ("all bytes", "".join(map(chr, range(256))) * 3),
+        ("text", "some plain text, longer than a few machine words"),
+        ("random", "".join([chr(random.randrange(256))
+                            for i in range(100003)]))]
+
+o = psycopg.connect(DSN)
+c = o.cursor()
+
+# a failed SET rolls back the transaction: try them before creating the table
+outputs = ["escape"]
+if setting(c, "bytea_output", "hex"): outputs.append("hex")
+
+# Binary() produces E'' style escapes without the E prefix
+setting(c, "standard_conforming_strings", "off")
+setting(c, "escape_string_warning", "off")
+c.execute("CREATE TEMP TABLE bytea_test (n int4, b bytea)")
+
+for hex in (0, 1):
+    if hex and "hex" not in outputs: continue
+    c.execute("DELETE FROM bytea_test")
+    for i in range(len(DATA)):
+        c.execute("INSERT INTO bytea_test VALUES (%s, %s)",
+                  (i, psycopg.Binary(DATA[i][1], hex)))
+
+    # the backend must have stored exactly the original bytes
+    c.execute("SELECT n, length(b), md5(b) FROM bytea_test ORDER BY n")
+    stored = c.fetchall()
+    for i in range(len(DATA)):
+        check("Binary(%s, hex=%d) stored" % (DATA[i][0], hex),
+              stored[i][1:], (len(DATA[i][1]), md5(DATA[i][1]).hexdigest()))
+
+    # and the typecaster must give them back in every output format
+    for output in outputs:
+        setting(c, "bytea_output", output)
+        c.execute("SELECT n, b FROM bytea_test ORDER BY n")
+        rows = c.fetchall()
+        for i in range(len(DATA)):
+            check("Binary(%s, hex=%d) read as %s" % (DATA[i][0], hex, output),
+                  rows[i][1], DATA[i][1])
+
+## the typecaster on values built by the backend
+
+for output in outputs:
+    setting(c, "bytea_output", output)
+    c.execute("SELECT decode('00ff5c27', 'hex'), ''::bytea, NULL::bytea")
+    check("decode() read as %s" % output, c.fetchone(),
+          ("\0\xff\\'", "", None))
+
+o.rollback()
+done()
@@ -0,0 +1,108 @@
+# check_named.py -- regression test for named (server-side) cursors
+#
+# usage: check_named.py DSN  (see checkutil.py)
+
+import psycopg
+from checkutil import DSN, check, raises, done
+
+def series(n):
+    return [(i,) for i in range(1, n + 1)]
+
+
+o = psycopg.connect(DSN)
+
+
+## batched and prefetched FETCH
+
+n = o.cursor('named_fetch')
+n.arraysize = 7
+n.execute("SELECT generate_series(1, 100)")
+check("rowcount", n.rowcount, -1)
+check("description", n.description is not None, True)
+rows = [n.fetchone(), n.fetchone(), n.fetchone()]
+rows = rows + n.fetchmany(10) + n.fetchmany()
+rows = rows + n.fetchall()
+check("fetch across batches", rows, series(100))
+check("fetchone at end", n.fetchone(), None)
+
+# the last batch is full: the prefetched FETCH returns no rows
+n.execute("SELECT generate_series(1, 21)")
+check("full last batch", n.fetchall(), series(21))
+
+n.execute("SELECT 1 WHERE false")
+check("no rows fetchall", n.fetchall(), [])
+check("no rows fetchone", n.fetchone(), None)
+
+# a new query while the next FETCH is still pending
+n.execute("SELECT generate_series(1, 50)")
+check("before re-execute", n.fetchmany(7), series(7))
+n.execute("SELECT generate_series(101, 110)")
+check("re-execute", n.fetchall(), [(i,) for i in range(101, 111)])
+
+n.execute("SELECT i, 'row ' || i AS s FROM generate_series(1, 10) AS i")
+check("dictfetchall", n.dictfetchall()[9], {'i': 10, 's': 'row 10'})
+o.rollback()
+
+
+## scroll() and MOVE, also backward on a plan that can't run backward
+
+n.arraysize = 10
+n.execute("SELECT i FROM (SELECT i FROM generate_series(1, 100) AS i "
+          "GROUP BY i) AS s")
+first = n.fetchall()
+check("scroll rows", len(first), 100)
+n.scroll(5, 'absolute')
+check("scroll backward", n.fetchone(), first[5])
+n.scroll(-3)
+check("scroll relative backward", n.fetchone(), first[3])
+n.scroll(1)
+check("scroll inside the batch", n.fetchone(), first[5])
+n.scroll(95, 'absolute')
+check("scroll forward", n.fetchall(), first[95:])
+raises("scroll before the start", IndexError, n.scroll, -1, 'absolute')
+
+# the cursor doesn't survive the end of the transaction
+o.commit()
+raises("scroll after commit", psycopg.Error,
+       n.scroll, 0, 'absolute')
+
+
+## statements that can't be DECLAREd are executed normally
+
+n.execute("CREATE TEMP TABLE named_test (i int4)")
+n.execute("INSERT INTO named_test SELECT generate_series(1, 10)")
+check("insert rowcount", n.rowcount, 10)
+n.execute("UPDATE named_test SET i = i WHERE i <= 3")
+check("update rowcount", n.rowcount, 3)
+n.execute("SELECT count(*) FROM named_test")
+check("select after insert", n.fetchall(), [(10,)])
+
+n.execute("WITH d AS (DELETE FROM named_test WHERE i > 5 RETURNING i) "
+          "SELECT count(*) FROM d")
+check("data-modifying WITH", n.fetchall(), [(5,)])
+n.execute("SELECT i INTO TEMP named_copy FROM named_test")
+n.execute("SELECT count(*) FROM named_copy")
+check("SELECT INTO", n.fetchall(), [(5,)])
+n.execute("SELECT i FROM named_test ORDER BY i FOR UPDATE")
+check("FOR UPDATE", n.fetchall(), series(5))
+n.execute("SELECT 'insert into', \"i\" AS \"update\" FROM named_test "
+          "WHERE i = 1")
+check("keywords in literals", n.fetchall(), [('insert into', 1)])
+o.rollback()
+del n
+
+
+## WITH HOLD: in autocommit the cursor survives the implicit commit
+
+o.autocommit()
+h = o.cursor('named_hold')
+h.arraysize = 5
+h.execute("SELECT generate_series(1, 20)")
+check("hold first batch", h.fetchmany(), series(5))
+check("hold other batches", h.fetchall(), [(i,) for i in range(6, 21)])
+h.scroll(2, 'absolute')
+check("hold scroll backward", h.fetchone(), (3,))
+o.autocommit(0)
+del h
+
+done()
@@ -0,0 +1,76 @@
+# check_pool.py -- regression test for the connection pool (see the maxconn,
+# minconn, timeout and idletime arguments of connect() and connection.pool())
+#
+# usage: check_pool.py DSN  (see checkutil.py)
+
+import time, threading
+import psycopg
+from checkutil import DSN, check, raises, done
+
+def counters(conn):
+    p = conn.pool()
+    return (p['size'], p['idle'], p['waits'], p['creates'], p['destroys'])
+
+
+## exhaustion with timeout=0 fails immediately
+
+o = psycopg.connect(DSN, maxconn=2, minconn=1, serialize=0, timeout=0,
+                    idletime=1)
+check("initial", counters(o), (1, 0, 0, 1, 0))
+
+c = o.cursor()
+check("second connection", counters(o), (2, 0, 0, 2, 0))
+
+t = time.time()
+raises("exhausted", psycopg.OperationalError, o.cursor)
+check("exhausted without waiting", time.time() - t < 1, True)
+check("exhausted", counters(o), (2, 0, 0, 2, 0))
+
+## a released connection is reused
+
+del c
+check("released", counters(o), (2, 1, 0, 2, 0))
+c = o.cursor()
+check("reused", counters(o), (2, 0, 0, 2, 0))
+
+## connections exceeding minconn are closed after idletime
+
+del c
+time.sleep(1.5)
+c = o.cursor()
+check("idle destroyed", counters(o), (2, 0, 0, 3, 1))
+del c
+o.close()
+
+
+## with a timeout cursors wait for a free connection
+
+o = psycopg.connect(DSN, maxconn=2, minconn=1, serialize=0, timeout=5)
+c = o.cursor()
+
+def release():
+    global c
+    time.sleep(0.5)
+    del c
+
+r = threading.Thread(target=release)
+r.start()
+t = time.time()
+d = o.cursor()
+check("waited", time.time() - t >= 0.4, True)
+check("waited counters", counters(o), (2, 0, 1, 2, 0))
+r.join()
+del d
+
+## and give up when the timeout expires
+
+o.timeout = 2
+c = o.cursor()
+t = time.time()
+raises("timeout", psycopg.OperationalError, o.cursor)
+check("timeout elapsed", 0.9 < time.time() - t < 4, True)
+check("timeout counters", counters(o), (2, 0, 2, 2, 0))
+del c
+o.close()
+
+done()
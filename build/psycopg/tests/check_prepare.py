@@ -0,0 +1,88 @@
+# check_prepare.py -- regression test for out-of-band parameters and the
+# statement cache (the prepare argument of execute() and cursor.stmtcache())
+#
+# usage: check_prepare.py DSN  (see checkutil.py)
+
+import psycopg
+from checkutil import DSN, check, raises, done
+
+def counters(curs):
+    s = curs.stmtcache()
+    return (s['hits'], s['misses'], s['size'])
+
+def prepared(curs):
+    curs.execute("SELECT count(*) FROM pg_prepared_statements")
+    return curs.fetchone()[0]
+
+
+o = psycopg.connect(DSN, serialize=0)
+c = o.cursor()
+QUERY = "SELECT %s::int4 + 1, %s::text"
+
+
+## prepare=0 sends the parameters out-of-band without caching
+
+c.execute(QUERY, (1, "it's"), prepare=0)
+check("prepare=0 result", c.fetchall(), [(2, "it's")])
+check("prepare=0 counters", counters(c), (0, 0, 0))
+
+## prepare=1 prepares on the first execution and reuses the statement
+
+c.execute(QUERY, (1, "a"), prepare=1)
+check("miss result", c.fetchall(), [(2, "a")])
+c.execute(QUERY, (2, None), prepare=1)
+check("hit result", c.fetchall(), [(3, None)])
+check("hit counters", counters(c), (1, 1, 1))
+check("prepared on the backend", prepared(c), 1)
+
+## a failing truth test of prepare raises instead of executing
+
+class Bad:
+    def __nonzero__(self): raise ZeroDivisionError
+raises("prepare truth test", ZeroDivisionError,
+       c.execute, QUERY, (1, "a"), Bad())
+o.rollback()
+
+
+## the least recently used statement is evicted after maxsize entries
+
+maxsize = c.stmtcache()['maxsize']
+for i in range(maxsize + 1):
+    c.execute("SELECT %%s::int4 + %d" % i, (i,), prepare=1)
+check("eviction size", c.stmtcache()['size'], maxsize)
+check("eviction backend", prepared(c), maxsize)
+
+hits, misses, size = counters(c)
+c.execute("SELECT %%s::int4 + %d" % maxsize, (0,), prepare=1)
+check("most recent is a hit", counters(c), (hits + 1, misses, size))
+c.execute(QUERY, (1, "a"), prepare=1)
+check("evicted is a miss", counters(c), (hits + 1, misses + 1, size))
+check("evicted result", c.fetchall(), [(2, "a")])
+o.rollback()
+
+
+## statements deallocated behind our back
+
+# in autocommit mode the statement is prepared again and executed
+o.autocommit()
+c.execute(QUERY, (1, "a"), prepare=1)
+c.execute("DEALLOCATE ALL")
+hits, misses, size = counters(c)
+c.execute(QUERY, (5, "b"), prepare=1)
+check("lost in autocommit result", c.fetchall(), [(6, "b")])
+check("lost in autocommit counters", counters(c)[:2], (hits + 1, misses + 1))
+o.autocommit(0)
+
+# inside a transaction the backend aborted it: a clear error is raised
+c.execute(QUERY, (1, "a"), prepare=1)
+c.execute("DEALLOCATE ALL")
+err = raises("lost in transaction", psycopg.OperationalError,
+             c.execute, QUERY, (1, "a"), 1)
+if err:
+    check("lost in transaction message", "rollback" in str(err), True)
+o.rollback()
+c.execute(QUERY, (1, "a"), prepare=1)
+check("after rollback", c.fetchall(), [(2, "a")])
+o.rollback()
+
+done()
@@ -1,5 +1,5 @@
 # this script is a regression test for the psycopg type system. its output
-# should be identical to the types.result files; any other result is an
+# should be identical to check_types.expected; any other result is an
 # indication of an error in the psycopg type system.
 
 import sys
@@ -99,4 +99,85 @@ c.execute("SELECT oid FROM types_test")
 row = c.fetchone()
 print "oid", test(c.description[0][1])
 
+
+
+## the row of NULLs: every column is None
+
+c.execute("SELECT * FROM types_test WHERE ivalue2 IS NULL")
+row = c.fetchone()
+print "nulls", row.count(None), len(row)
+
+
+## dictfetch*() keys are the column names, as given by the backend
+
+c.execute('SELECT name1, ivalue2 AS "Mixed Case", date1 FROM types_test '
+          'ORDER BY ivalue2')
+for d in [c.dictfetchone()] + c.dictfetchmany(1) + c.dictfetchall():
+    if d is None: continue
+    keys = d.keys()
+    keys.sort()
+    for k in keys: print k, str(d[k]),
+    print
+
+
+## user-defined casts get the value as a python string (or None)
+
+def usercast(s):
+    return "usercast(%s)" % repr(s)
+
+c.execute("SELECT ivalue2 FROM types_test")
+register_type(new_type((c.description[0][1],), "USERCAST", usercast))
+
+c.execute("SELECT ivalue2, ivalue3 FROM types_test ORDER BY ivalue2")
+for row in c.fetchall():
+    print row[0], row[1]
+c.execute("SELECT ivalue2 AS i FROM types_test ORDER BY ivalue2")
+for d in c.dictfetchall():
+    print d['i']
+
+
+
+## the date and time parsers: the values sent by the backend...
+
+def fields(v):
+    if v is None: return "None"
+    if hasattr(v, 'year'):
+        return "%d-%02d-%02d %02d:%02d:%06.3f" % \
+               (v.year, v.month, v.day, v.hour, v.minute, v.second)
+    return "%02d:%02d:%06.3f" % (v.hour, v.minute, v.second)
+
+c.execute("SET TIME ZONE INTERVAL '+02:00' HOUR TO MINUTE")
+c.execute("SELECT '0044-03-15'::date, '0044-03-15 12:00:00 BC'::timestamp, "
+          "'12345-06-07'::date, '12345-06-07 01:02:03'::timestamp, "
+          "'infinity'::date, '-infinity'::date, "
+          "'2001-10-13 07:08:09.125'::timestamp, "
+          "'2001-10-13 07:08:09.5+05'::timestamptz, "
+          "'13:12:11.25'::time, '13:12:11.25+05:30'::timetz")
+for v in c.fetchone():
+    print fields(v)
+
+## ...and the other layouts they accept or refuse
+
+for s in ("2001-10-13T07:08:09", "2001-10-13 07:08:09-03:30:15",
+          "2001-10-13 07:08:09.123456789123", "2001-1-13", "2001-10-13 BCE",
+          "2001-10-13 07:08", "2001-10-13 07:08:09+5", "infinity "):
+    try:
+        print repr(s), fields(DATE(s))
+    except DataError:
+        print repr(s), "DataError"
+for s in ("13:12:11-11", "13:12", "13:12:11.", "13:12:11 "):
+    try:
+        print repr(s), fields(TIME(s))
+    except DataError:
+        print repr(s), "DataError"
+
+## repeated date values are parsed once per result, unless datememo is 0
+
+q = "SELECT '2001-10-13 07:08:09'::timestamp FROM generate_series(1, 2)"
+for memo in (1, 0):
+    c.datememo = memo
+    c.execute(q)
+    a, b = c.fetchall()
+    print "datememo", memo, fields(a[0]), a[0] == b[0], a[0] is b[0]
+
 #o.commit()
@@ -0,0 +1,52 @@
+# checkutil.py -- helpers shared by the tests/check_*.py regression tests
+#
+# every check script takes the DSN as its only argument, prints nothing but
+# the failed checks and exits with status 1 if any check failed:
+#
+#     from checkutil import DSN, check, raises, done
+#     ...
+#     check("what is checked", got, expected)
+#     done()
+
+import sys
+
+if len(sys.argv) > 1:
+    DSN = sys.argv[1]
+else:
+    sys.stderr.write("Error: missing connection DSN\n")
+    sys.exit(1)
+
+failed = 0
+
+def _short(value):
+    r = repr(value)
+    if len(r) > 72: r = r[:72] + "..."
+    return r
+
+def fail(name, msg):
+    """report a failed check"""
+    global failed
+    print "FAILED %s:\n    %s" % (name, msg)
+    failed = 1
+
+def check(name, got, expected):
+    """check that got is equal to expected"""
+    if got != expected:
+        fail(name, "got      %s\n    expected %s" %
+             (_short(got), _short(expected)))
+
+def raises(name, exc, func, *args):
+    """check that func(*args) raises exc and return the exception"""
+    try:
+        func(*args)
+    except exc, err:
+        return err
+    except Exception, err:
+        fail(name, "raised %s: %s, expected %s" %
+             (err.__class__.__name__, err, exc.__name__))
+    else:
+        fail(name, "%s not raised" % exc.__name__)
+
+def done():
+    """exit with status 1 if any check failed"""
+    sys.exit(failed)
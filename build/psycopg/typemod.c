@@ -25,6 +25,8 @@
 
 #include "module.h"
 #include "typemod.h"
+#define PSYCO_BYTEA_ENCODE
+#include "bytea.h"
 #include <assert.h>
 
 /**** DateTimeObject OBJECT DEFINITIONS ****/
@@ -242,99 +244,67 @@ PyTypeObject psyco_BufferObject_Type = {
     psyco_BufferObject__doc__                   /* Documentation string */
 };
 
+/* new_psyco_bufferobject() - quote a string of bytes as a bytea literal
+ *
+ * if hex is true the hex format is used: it is faster to produce and more
+ * compact for binary data, but only PostgreSQL 9.0 and later can read it.
+ */
 static PyObject *
-new_psyco_bufferobject(PyObject *buffer)
+new_psyco_bufferobject(PyObject *buffer, int hex)
 {
+    static int initialized = 0;
     psyco_BufferObject *obj;
-    unsigned char *original, *quoted, *chptr, *newptr;
-    int i, len, space, new_space;
+    unsigned char *original, *quoted, *chptr;
+    Py_ssize_t len, space;
 
 #if defined(_WIN32) || defined(__CYGWIN__)
     /* For MSVC workaround */
     psyco_BufferObject_Type.ob_type = &PyType_Type;
 #endif
 
-    obj = PyObject_NEW(psyco_BufferObject, &psyco_BufferObject_Type);
-    if (obj == NULL) return NULL;
+    if (!initialized) {
+        _psyco_bytea_init();
+        initialized = 1;
+    }
 
     original = (unsigned char*)PyString_AS_STRING(buffer);
     len = PyString_GET_SIZE(buffer);
-    space = len + 2;
 
-    Py_BEGIN_ALLOW_THREADS;
+    /* quotes and \\x prefix or the escaped bytes */
+    if (hex)
+        space = 2*len + 5;
+    else
+        space = _psyco_bytea_escapelen(original, len) + 2;
 
-    quoted = (unsigned char*)calloc(space, sizeof(char));
-    if (quoted == NULL) return NULL;
+    obj = PyObject_NEW(psyco_BufferObject, &psyco_BufferObject_Type);
+    if (obj == NULL) return NULL;
+    obj->buffer = PyString_FromStringAndSize(NULL, space + ESCAPESLACK);
+    if (obj->buffer == NULL) {
+        PyObject_Del(obj);
+        return NULL;
+    }
+    quoted = (unsigned char*)PyString_AS_STRING(obj->buffer);
 
+    Py_BEGIN_ALLOW_THREADS;
     chptr = quoted;
-    *chptr = '\'';
-    chptr++;
-
-    for (i=0; i < len; i++) {
-        if (chptr - quoted > space - 6) {
-            new_space  =  space * ((space) / (i + 1)) + 2 + 6;
-            if (new_space - space < 1024) space += 1024;
-            else space = new_space;
-            newptr = (unsigned char *)realloc(quoted, space);
-            if (newptr == NULL) {
-                free(quoted);
-                return NULL;
-            }
-            /*chptr has to be moved to the new location*/
-            chptr = newptr + (chptr - quoted);
-            quoted = newptr;
-            Dprintf("new_psyco_bufferobject(): reallocated %i bytes at %p \n",
-                    space, quoted);
-        }
-        if (original[i]) {
-            if (original[i] >= ' ' && original[i] <= '~') {
-                if (original[i] == '\'') {
-                    *chptr = '\\';
-                    chptr++;
-                    *chptr = '\'';
-                    chptr++;
-                }
-                else if (original[i] == '\\') {
-                    memcpy(chptr, "\\\\\\\\", 4);
-                    chptr += 4;
-                }
-                else {
-                    /* leave it as it is if ascii printable */
-                    *chptr = original[i];
-                    chptr++;
-                }
-            }
-            else {
-                unsigned char c;
-                
-                /* escape to octal notation \nnn */
-                *chptr++ = '\\';
-                *chptr++ = '\\';
-                c = original[i];
-                *chptr = ((c >> 6) & 0x07) + 0x30;
-                chptr++;
-                *chptr = ((c >> 3) & 0x07) + 0x30;
-                chptr++;
-                *chptr = (c & 0x07) + 0x30;
-                chptr++;
-            }
-        }
-        else {
-            /* escape null as \\000 */
-            memcpy(chptr, "\\\\000", 5);
-            chptr += 5;
-        }
+    *chptr++ = '\'';
+    if (hex) {
+        memcpy(chptr, "\\\\x", 3);
+        chptr = _psyco_bytea_hex(chptr + 3, original, len);
+    }
+    else {
+        chptr = _psyco_bytea_escape(chptr, original, len);
     }
     *chptr = '\'';
-
     Py_END_ALLOW_THREADS;
 
-    Dprintf("new_psyco_bufferobject(): quoted = %s\n", quoted);
-    obj->buffer = PyString_FromStringAndSize((char*)quoted, 
-                                             chptr - quoted + 1 );
-    free(quoted);
-    
-    Dprintf("new_psyco_bufferobject: object created at %p\n", obj);
+    assert(chptr - quoted + 1 == space);
+    if (_PyString_Resize(&(obj->buffer), space) < 0) {
+        PyObject_Del(obj);
+        return NULL;
+    }
+    Dprintf("new_psyco_bufferobject: object created at %p, %d bytes\n",
+            obj, (int)space);
     return (PyObject *)obj;
 }
 
@@ -652,10 +622,11 @@ PyObject *
 psyco_Binary(PyObject *self, PyObject *args)
 {
     PyObject *str;
+    int hex = 0;
 
-    if (!PyArg_ParseTuple(args, "O!", &PyString_Type, &str))
+    if (!PyArg_ParseTuple(args, "O!|i", &PyString_Type, &str, &hex))
         return NULL;
-    return new_psyco_bufferobject(str);
+    return new_psyco_bufferobject(str, hex);
 }
 
 PyObject *
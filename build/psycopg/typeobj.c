@@ -25,7 +25,11 @@
 
 #include "module.h"
 #include "typeobj.h"
+#define PSYCO_BYTEA_DECODE
+#include "bytea.h"
 #include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
 
 static PyObject *psyco_DBAPITypeObject_new(PyObject *, PyObject *, PyObject *);
 extern PyTypeObject psyco_DBAPITypeObject_Type;
@@ -65,88 +69,190 @@ psyco_STRING_cast(PyObject *s)
     return s;
 }
 
+/* the date and time parsers below work on the fixed ISO layout requested by
+   the SET DATESTYLE sent on every new connection; they don't need a NUL
+   terminated string and don't allocate anything, so that the raw casts can
+   call them directly on the libpq buffer */
+
+static const double psyco_fracscale[10] = {
+    1.0, 1e-1, 1e-2, 1e-3, 1e-4, 1e-5, 1e-6, 1e-7, 1e-8, 1e-9
+};
+
+/* _psyco_parse_int() - parse from min to max (at most 9) digits
+ *
+ * returns a pointer to the first character after the number or NULL if less
+ * than min digits are available.
+ */
+static const char *
+_psyco_parse_int(const char *s, const char *end, int min, int max, int *v)
+{
+    const char *start = s;
+    int n = 0;
+
+    if (end - s > max) end = s + max;
+    while (s < end && (unsigned int)(*s - '0') < 10) {
+        n = n*10 + (*s - '0');
+        s++;
+    }
+    if (s - start < min) return NULL;
+    *v = n;
+    return s;
+}
+
+/* _psyco_parse_time() - parse HH:MM:SS[.ffffff][+HH[:MM[:SS]]]
+ *
+ * fractions of a second beyond the nanosecond are silently dropped; the
+ * timezone offset (if present) is returned in seconds east of UTC.
+ */
+static const char *
+_psyco_parse_time(const char *s, const char *end,
+                  int *hh, int *mm, double *ss, int *tz)
+{
+    const char *p;
+    int sec, frac, sign, tzh, tzm = 0, tzs = 0;
+
+    if (!(s = _psyco_parse_int(s, end, 2, 2, hh))
+        || s >= end || *s++ != ':'
+        || !(s = _psyco_parse_int(s, end, 2, 2, mm))
+        || s >= end || *s++ != ':'
+        || !(s = _psyco_parse_int(s, end, 2, 2, &sec)))
+        return NULL;
+    *ss = (double)sec;
+
+    if (s < end && *s == '.') {
+        p = ++s;
+        if (!(s = _psyco_parse_int(s, end, 1, 9, &frac))) return NULL;
+        *ss += frac * psyco_fracscale[s - p];
+        while (s < end && (unsigned int)(*s - '0') < 10) s++;
+    }
+
+    *tz = 0;
+    if (s < end && (*s == '+' || *s == '-')) {
+        sign = (*s++ == '-') ? -1 : 1;
+        if (!(s = _psyco_parse_int(s, end, 2, 2, &tzh))) return NULL;
+        if (s < end && *s == ':') {
+            if (!(s = _psyco_parse_int(s+1, end, 2, 2, &tzm))) return NULL;
+            if (s < end && *s == ':') {
+                if (!(s = _psyco_parse_int(s+1, end, 2, 2, &tzs)))
+                    return NULL;
+            }
+        }
+        *tz = sign * (tzh*3600 + tzm*60 + tzs);
+    }
+    return s;
+}
+
+/* psyco_DATE_parse() - build a DateTime from a date or a timestamp
+ *
+ * accepts YYYY-MM-DD[ HH:MM:SS[.ffffff][+tz]][ BC] and [-]infinity. the
+ * timezone offset of a timestamptz is checked but not applied: mxDateTime
+ * objects are naive and the value is already in the session time zone.
+ */
 static PyObject *
-psyco_DATE_cast(PyObject *s)
+psyco_DATE_parse(const char *str, int len)
 {
-    int n, y=0, m=0, d=0;
-    int hh=0, mm=0;
-    double ss=0.0;
-    
-    char *str;
+    const char *s = str, *end = str + len;
+    int y, m, d, hh = 0, mm = 0, tz = 0;
+    double ss = 0.0;
+
+    Dprintf("psyco_DATE_parse(): s = %.*s\n", len, str);
 
-    if (s == Py_None) {Py_INCREF(s); return s;}
-    str = PyString_AsString(s);
-    
     /* check for infinity */
-    if (!strcmp(str, "infinity") || !strcmp(str, "-infinity")) {
-        if (str[0] == '-') {
-            return mxDateTimeP->DateTime_FromDateAndTime(-999998,1,1, 0,0,0);
-        }
-        else {
-            return mxDateTimeP->DateTime_FromDateAndTime(999999,12,31, 0,0,0);
-        }
+    if (len == 8 && !memcmp(str, "infinity", 8))
+        return mxDateTimeP->DateTime_FromDateAndTime(999999,12,31, 0,0,0);
+    if (len == 9 && !memcmp(str, "-infinity", 9))
+        return mxDateTimeP->DateTime_FromDateAndTime(-999998,1,1, 0,0,0);
+
+    if (!(s = _psyco_parse_int(s, end, 4, 9, &y))
+        || s >= end || *s++ != '-'
+        || !(s = _psyco_parse_int(s, end, 2, 2, &m))
+        || s >= end || *s++ != '-'
+        || !(s = _psyco_parse_int(s, end, 2, 2, &d)))
+        goto error;
+
+    if (s < end && (*s == ' ' || *s == 'T')
+        && end - s > 2 && (unsigned int)(s[1] - '0') < 10) {
+        if (!(s = _psyco_parse_time(s+1, end, &hh, &mm, &ss, &tz)))
+            goto error;
     }
-    
-    Dprintf("psyco_DATE_cast(): s = %s\n", str);
-    n = sscanf(str, "%d-%d-%d %d:%d:%lf", &y, &m, &d, &hh, &mm, &ss);
-    Dprintf("psyco_DATE_cast(): date parsed, %d components\n", n);
-    
-    if (n != 3 && n != 6) {
-        PyErr_SetString(DataError, "unable to parse date or timestamp");
-        return NULL;
+
+    /* years before christ: there is no year 0 in postgres, there is one in
+       mxDateTime (1 BC) */
+    if (end - s == 3 && !memcmp(s, " BC", 3)) {
+        y = 1 - y;
+        s = end;
     }
+    if (s != end) goto error;
+
+    Dprintf("psyco_DATE_parse(): %d-%d-%d %d:%d:%f, tz = %d\n",
+            y, m, d, hh, mm, ss, tz);
     return mxDateTimeP->DateTime_FromDateAndTime(y, m, d, hh, mm, ss);
+
+  error:
+    PyErr_SetString(DataError, "unable to parse date or timestamp");
+    return NULL;
 }
 
+/* psyco_TIME_parse() - build a DateTimeDelta from a time
+ *
+ * accepts HH:MM:SS[.ffffff][+tz]; the offset of a timetz is checked and
+ * then dropped. unlike timestamptz values, that are always converted to the
+ * session time zone, a timetz keeps the offset it was stored with, so the
+ * returned time is in that (lost) offset.
+ */
 static PyObject *
-psyco_TIME_cast(PyObject *s)
+psyco_TIME_parse(const char *str, int len)
 {
-    int n, hh=0, mm=0;
-    double ss=0.0;
-    
-    char *str;
+    const char *s, *end = str + len;
+    int hh, mm, tz;
+    double ss;
 
-    if (s == Py_None) {Py_INCREF(s); return s;}
-    str = PyString_AsString(s);
-    /* postgres gives us only the time but a DateTime object wants a date too,
-       so we use the unix epoch as the current date. */
-    
-    Dprintf("psyco_TIME_cast(): s = %s\n", str);
-    
-    n = sscanf(str, "%d:%d:%lf", &hh, &mm, &ss);
-    Dprintf("psyco_TIME_cast(): time parsed, %d components\n", n);
-    Dprintf("psyco_TIME_cast(): hh = %d, mm = %d, ss = %f\n", hh, mm, ss);
-    
-    if (n != 3) {
+    Dprintf("psyco_TIME_parse(): s = %.*s\n", len, str);
+
+    s = _psyco_parse_time(str, end, &hh, &mm, &ss, &tz);
+    if (s != end) {
         PyErr_SetString(DataError, "unable to parse time");
         return NULL;
     }
 
+    Dprintf("psyco_TIME_parse(): hh = %d, mm = %d, ss = %f, tz = %d\n",
+            hh, mm, ss, tz);
     return mxDateTimeP->DateTimeDelta_FromTime(hh, mm ,ss);
 }
 
-static char *
-skip_until_space(char *s)
+static PyObject *
+psyco_DATE_cast(PyObject *s)
 {
-    while (*s && *s != ' ') s++;
+    if (s == Py_None) {Py_INCREF(s); return s;}
+    return psyco_DATE_parse(PyString_AS_STRING(s), PyString_GET_SIZE(s));
+}
+
+static PyObject *
+psyco_TIME_cast(PyObject *s)
+{
+    if (s == Py_None) {Py_INCREF(s); return s;}
+    return psyco_TIME_parse(PyString_AS_STRING(s), PyString_GET_SIZE(s));
+}
+
+static const char *
+skip_until_space(const char *s, const char *end)
+{
+    while (s < end && *s != ' ') s++;
     return s;
 }
 
 static PyObject *
-psyco_INTERVAL_cast(PyObject *s)
+psyco_INTERVAL_parse(const char *str, int len)
 {
     long years = 0, months = 0, days = 0, denominator = 1;
     double hours = 0.0, minutes = 0.0, seconds = 0.0, hundredths = 0.0;
     double v = 0.0, sign = 1.0;
     int part = 0;
-    char *str;
+    const char *end = str + len;
 
-    if (s == Py_None) {Py_INCREF(s); return s;}
-    
-    str = PyString_AsString(s);
-    Dprintf("psyco_INTERVAL_cast(): s = %s\n", str);
+    Dprintf("psyco_INTERVAL_parse(): s = %.*s\n", len, str);
     
-    while (*str) {
+    while (str < end) {
         switch (*str) {
 
         case '-':
@@ -156,10 +262,10 @@ psyco_INTERVAL_cast(PyObject *s)
         case '0': case '1': case '2': case '3': case '4':
         case '5': case '6': case '7': case '8': case '9':
             v = v*10 + (double)*str - (double)'0';
-            Dprintf("psyco_INTERVAL_cast(): v = %f\n", v);
+            Dprintf("psyco_INTERVAL_parse(): v = %f\n", v);
             if (part == 6){
                 denominator *= 10;
-                Dprintf("psyco_INTERVAL_cast(): denominator = %ld\n",
+                Dprintf("psyco_INTERVAL_parse(): denominator = %ld\n",
                         denominator);
             }
             break;
@@ -167,9 +273,9 @@ psyco_INTERVAL_cast(PyObject *s)
         case 'y':
             if (part == 0) {
                 years = (long)(v*sign);
-                str = skip_until_space(str);
-                Dprintf("psyco_INTERVAL_cast(): years = %ld, rest = %s\n",
-                        years, str);
+                str = skip_until_space(str, end);
+                Dprintf("psyco_INTERVAL_parse(): years = %ld, rest = %.*s\n",
+                        years, (int)(end - str), str);
                 v = 0.0; sign = 1.0; part = 1;
             }
             break;
@@ -177,9 +283,9 @@ psyco_INTERVAL_cast(PyObject *s)
         case 'm':
             if (part <= 1) {
                 months = (long)(v*sign);
-                str = skip_until_space(str);
-                Dprintf("psyco_INTERVAL_cast(): months = %ld, rest = %s\n",
-                        months, str);
+                str = skip_until_space(str, end);
+                Dprintf("psyco_INTERVAL_parse(): months = %ld, rest = %.*s\n",
+                        months, (int)(end - str), str);
                 v = 0.0; sign = 1.0; part = 2;
             }
             break;
@@ -187,9 +293,9 @@ psyco_INTERVAL_cast(PyObject *s)
         case 'd':
             if (part <= 2) {
                 days = (long)(v*sign);
-                str = skip_until_space(str);
-                Dprintf("psyco_INTERVAL_cast(): days = %ld, rest = %s\n",
-                        days, str);
+                str = skip_until_space(str, end);
+                Dprintf("psyco_INTERVAL_parse(): days = %ld, rest = %.*s\n",
+                        days, (int)(end - str), str);
                 v = 0.0; sign = 1.0; part = 3;
             }
             break;
@@ -197,12 +303,12 @@ psyco_INTERVAL_cast(PyObject *s)
         case ':':
             if (part <= 3) {
                 hours = v;
-                Dprintf("psyco_INTERVAL_cast(): hours = %f\n", hours);
+                Dprintf("psyco_INTERVAL_parse(): hours = %f\n", hours);
                 v = 0.0; part = 4;
             }
             else if (part == 4) {
                 minutes = v;
-                Dprintf("psyco_INTERVAL_cast(): minutes = %f\n", minutes);
+                Dprintf("psyco_INTERVAL_parse(): minutes = %f\n", minutes);
                 v = 0.0; part = 5;
             }
             break;
@@ -210,7 +316,7 @@ psyco_INTERVAL_cast(PyObject *s)
         case '.':
             if (part == 5) {
                 seconds = v;
-                Dprintf("psyco_INTERVAL_cast(): seconds = %f\n", seconds);
+                Dprintf("psyco_INTERVAL_parse(): seconds = %f\n", seconds);
                 v = 0.0; part = 6;
             }
             break;   
@@ -225,17 +331,17 @@ psyco_INTERVAL_cast(PyObject *s)
     /* manage last value, be it minutes or seconds or hundredths of a second */
     if (part == 4) {
         minutes = v;
-        Dprintf("psyco_INTERVAL_cast(): minutes = %f\n", minutes);
+        Dprintf("psyco_INTERVAL_parse(): minutes = %f\n", minutes);
     }
     else if (part == 5) {
         seconds = v;
-        Dprintf("psyco_INTERVAL_cast(): seconds = %f\n", seconds);
+        Dprintf("psyco_INTERVAL_parse(): seconds = %f\n", seconds);
     }
     else if (part == 6) {
         hundredths = v;
-        Dprintf("psyco_INTERVAL_cast(): hundredths = %f\n", hundredths);
+        Dprintf("psyco_INTERVAL_parse(): hundredths = %f\n", hundredths);
         hundredths = hundredths/denominator;
-        Dprintf("psyco_INTERVAL_cast(): ACTUAL FRACTIONS = %.20f\n", hundredths);
+        Dprintf("psyco_INTERVAL_parse(): ACTUAL FRACTIONS = %.20f\n", hundredths);
     }
     
     /* calculates seconds */
@@ -249,11 +355,18 @@ psyco_INTERVAL_cast(PyObject *s)
     /* calculates days */
     days += years*365 + months*30;
     
-    Dprintf("psyco_INTERVAL_cast(): days = %ld, seconds = %f\n",
+    Dprintf("psyco_INTERVAL_parse(): days = %ld, seconds = %f\n",
             days, seconds);
     return mxDateTimeP->DateTimeDelta_FromDaysAndSeconds(days, seconds);
 }
 
+static PyObject *
+psyco_INTERVAL_cast(PyObject *s)
+{
+    if (s == Py_None) {Py_INCREF(s); return s;}
+    return psyco_INTERVAL_parse(PyString_AS_STRING(s), PyString_GET_SIZE(s));
+}
+
 static PyObject *
 psyco_BOOLEAN_cast(PyObject *s)
 {
@@ -262,49 +375,130 @@ psyco_BOOLEAN_cast(PyObject *s)
     else return PyInt_FromLong(0L);
 }
 
-/* convert all the \xxx octal sequences to the proper byte value */
+/* psyco_bytea_decode() - decode a bytea value in hex or escape format
+ *
+ * the bytes are written directly into the returned string by the kernels in
+ * bytea.h, without holding the interpreter lock.
+ */
 static PyObject *
-psyco_BINARY_cast(PyObject *s)
+psyco_bytea_decode(const char *s, Py_ssize_t len)
 {
-    char *str, *dstptr, *dststr;
-    int len, i;
-    PyObject *retstr;
+    PyObject *res;
+    unsigned char *dst;
+    Py_ssize_t n;
+    int bad;
+
+    if (len >= 2 && s[0] == '\\' && s[1] == 'x') {
+        n = (len - 2) / 2;
+        if (!(res = PyString_FromStringAndSize(NULL, n))) return NULL;
+        dst = (unsigned char *)PyString_AS_STRING(res);
+
+        Py_BEGIN_ALLOW_THREADS;
+        bad = _psyco_bytea_unhex(dst, (const unsigned char *)s + 2, n);
+        Py_END_ALLOW_THREADS;
+
+        if (bad || (len & 1)) {
+            Py_DECREF(res);
+            PyErr_SetString(DataError, "invalid hex format for bytea");
+            return NULL;
+        }
+        Dprintf("psyco_bytea_decode: hex, len: %d\n", (int)n);
+        return res;
+    }
 
-    if (s == Py_None) {Py_INCREF(s); return s;}
-   
-    str = PyString_AS_STRING(s);
-    len = strlen(str);
-    dststr = (char*)calloc(len, sizeof(char));
-    dstptr = dststr;
+    if (!(res = PyString_FromStringAndSize(NULL, len))) return NULL;
+    dst = (unsigned char *)PyString_AS_STRING(res);
 
     Py_BEGIN_ALLOW_THREADS;
-   
-    for (i = 0; i < len; i++) {
-        if (str[i] == '\\') {
-            if ( ++i < len) {
-                if (str[i] == '\\') {
-                    *dstptr = '\\';
-                }
-                else {
-                    *dstptr = 0;
-                    *dstptr |= (str[i++] & 7) << 6;
-                    *dstptr |= (str[i++] & 7) << 3;
-                    *dstptr |= (str[i] & 7);
-                }
-            }
-        }
-        else {
-            *dstptr = str[i];
-        }
-        dstptr++;
-    }
-    
+    n = _psyco_bytea_unescape(dst, s, len) - dst;
     Py_END_ALLOW_THREADS;
 
-    Dprintf("Binary: %s, len: %d\n", dststr, dstptr - dststr);
-    retstr = PyString_FromStringAndSize(dststr, dstptr - dststr);
-    free(dststr);
-    return retstr;
+    Dprintf("psyco_bytea_decode: escape, len: %d\n", (int)n);
+    if (n < len && _PyString_Resize(&res, n) < 0)
+        return NULL;
+    return res;
+}
+
+/* convert a bytea value to the string of bytes it represents */
+static PyObject *
+psyco_BINARY_cast(PyObject *s)
+{
+    if (s == Py_None) {Py_INCREF(s); return s;}
+    return psyco_bytea_decode(PyString_AS_STRING(s), PyString_GET_SIZE(s));
+}
+
+
+/**** builtin C raw casting functions ****/
+
+/* these functions work directly on the buffers returned by libpq, avoiding
+   the temporary python string and the call machinery used by the functions
+   above; they are used by the cursor to materialize rows */
+
+static PyObject *
+psyco_INTEGER_rawcast(char *s, int len)
+{
+    char *end;
+    long l;
+
+    errno = 0;
+    l = strtol(s, &end, 10);
+    if (len == 0 || errno != 0 || end != s + len) return NULL;
+    return PyInt_FromLong(l);
+}
+
+static PyObject *
+psyco_LONGINTEGER_rawcast(char *s, int len)
+{
+    return PyLong_FromString(s, NULL, 10);
+}
+
+static PyObject *
+psyco_FLOAT_rawcast(char *s, int len)
+{
+    char *end;
+    double d;
+
+    /* strtod() depends on the locale: if the whole string was not consumed
+       let PyNumber_Float() do the job */
+    d = strtod(s, &end);
+    if (len == 0 || end != s + len) return NULL;
+    return PyFloat_FromDouble(d);
+}
+
+static PyObject *
+psyco_STRING_rawcast(char *s, int len)
+{
+    return PyString_FromStringAndSize(s, len);
+}
+
+static PyObject *
+psyco_BOOLEAN_rawcast(char *s, int len)
+{
+    return PyInt_FromLong(s[0] == 't' ? 1L : 0L);
+}
+
+static PyObject *
+psyco_BINARY_rawcast(char *s, int len)
+{
+    return psyco_bytea_decode(s, len);
+}
+
+static PyObject *
+psyco_DATE_rawcast(char *s, int len)
+{
+    return psyco_DATE_parse(s, len);
+}
+
+static PyObject *
+psyco_TIME_rawcast(char *s, int len)
+{
+    return psyco_TIME_parse(s, len);
+}
+
+static PyObject *
+psyco_INTERVAL_rawcast(char *s, int len)
+{
+    return psyco_INTERVAL_parse(s, len);
 }
 
 
@@ -318,6 +512,26 @@ psyco_BINARY_cast(PyObject *s)
 #include "typeobj_builtins.c"
 
 
+/* the raw casting function for every builtin C casting function that has
+   one; used by new_psyco_typeobject() to fill the rcast field */
+
+static struct {
+    dbapitypeobject_cast_function     ccast;
+    dbapitypeobject_rawcast_function  rcast;
+} psyco_rawcast_types[] = {
+    {psyco_INTEGER_cast, psyco_INTEGER_rawcast},
+    {psyco_LONGINTEGER_cast, psyco_LONGINTEGER_rawcast},
+    {psyco_FLOAT_cast, psyco_FLOAT_rawcast},
+    {psyco_STRING_cast, psyco_STRING_rawcast},
+    {psyco_BOOLEAN_cast, psyco_BOOLEAN_rawcast},
+    {psyco_BINARY_cast, psyco_BINARY_rawcast},
+    {psyco_DATE_cast, psyco_DATE_rawcast},
+    {psyco_TIME_cast, psyco_TIME_rawcast},
+    {psyco_INTERVAL_cast, psyco_INTERVAL_rawcast},
+    {NULL, NULL}
+};
+
+
 /**** the type dictionary and associated functions ****/
 
 /* dictionary of types and default cast object */
@@ -625,6 +839,7 @@ psyco_DBAPITypeObject_new(PyObject *name, PyObject *values, PyObject *cast)
         obj->pcast = cast;
     }
     obj->ccast = NULL;
+    obj->rcast = NULL;
     
     Dprintf("psyco_DBAPITypeObject_new: name = %p, values = %p, "
             "pcast = %p, ccast = %p\n",
@@ -683,7 +898,97 @@ new_psyco_typeobject(psyco_DBAPIInitList *type)
     if (obj) {
         obj->ccast = type->cast;
         obj->pcast = NULL;
+        for (i = 0; psyco_rawcast_types[i].ccast != NULL; i++) {
+            if (psyco_rawcast_types[i].ccast == type->cast) {
+                obj->rcast = psyco_rawcast_types[i].rcast;
+                break;
+            }
+        }
     }
     return (PyObject *)obj;
 }
 
+
+/* psyco_get_castinfo() - resolve the casting functions of a type object
+ *
+ * the cursor calls this function once per column when a new result is
+ * available, so that fetching rows does not need to look up (or call through
+ * python) the type object for every value. if memo is true date and time
+ * columns (not intervals) also get a memo (see psyco_memo_rawcast() below.)
+ */
+void
+psyco_get_castinfo(PyObject *obj, psyco_CastInfo *info, int memo)
+{
+    psyco_DBAPITypeObject *type = (psyco_DBAPITypeObject *)obj;
+
+    info->cast = obj;
+    info->rcast = type->rcast;
+    info->ccast = type->ccast;
+    info->memo = NULL;
+
+    if (memo && info->rcast && (info->ccast == psyco_DATE_cast
+                                || info->ccast == psyco_TIME_cast)) {
+        /* without a memo the values are simply parsed every time */
+        info->memo = (psyco_CastMemo *)calloc(DATEMEMO,
+                                              sizeof(psyco_CastMemo));
+    }
+}
+
+/* psyco_free_castinfo() - free an array of n psyco_CastInfo
+ *
+ * releases the objects kept in the memos too, so it must be called with the
+ * global interpreter lock held.
+ */
+void
+psyco_free_castinfo(psyco_CastInfo *info, int n)
+{
+    int i, j;
+
+    for (i = 0; i < n; i++) {
+        if (info[i].memo == NULL) continue;
+        for (j = 0; j < DATEMEMO; j++) {
+            Py_XDECREF(info[i].memo[j].value);
+        }
+        free(info[i].memo);
+    }
+    free(info);
+}
+
+/* psyco_memo_rawcast() - raw cast through the memo of a column
+ *
+ * date and timestamp columns tend to repeat the same values (all the rows
+ * inserted in a day, the validity of a price list) and the objects built by
+ * mxDateTime are immutable, so instead of parsing the value again we return
+ * a new reference to the object built the last time the same string was
+ * seen. the memo is a small direct-mapped table indexed by a hash of the
+ * string; a collision simply replaces the old entry.
+ */
+PyObject *
+psyco_memo_rawcast(psyco_CastInfo *info, char *s, int len)
+{
+    psyco_CastMemo *entry;
+    unsigned int h = 2166136261U;
+    PyObject *val;
+    int i;
+
+    if (len > DATEMEMOKEY) return info->rcast(s, len);
+
+    /* FNV-1a, the strings are short and differ mostly in the last digits */
+    for (i = 0; i < len; i++) h = (h ^ (unsigned char)s[i]) * 16777619U;
+    entry = &(info->memo[h & (DATEMEMO - 1)]);
+
+    if (entry->value && entry->len == len && !memcmp(entry->key, s, len)) {
+        Py_INCREF(entry->value);
+        return entry->value;
+    }
+
+    val = info->rcast(s, len);
+    if (val == NULL) return NULL;
+
+    Py_XDECREF(entry->value);
+    Py_INCREF(val);
+    entry->value = val;
+    entry->len = len;
+    memcpy(entry->key, s, len);
+    return val;
+}
@@ -43,16 +43,43 @@ extern PyObject *psyco_binary_cast;
 /* type of type-casting functions (both C and Python) */
 typedef PyObject *(*dbapitypeobject_cast_function)(PyObject *);
 
+/* type of the raw casting functions, converting directly the value returned
+   by PQgetvalue() (and its length); a raw cast returning NULL without
+   setting an exception asks the caller to use the normal casting function */
+typedef PyObject *(*dbapitypeobject_rawcast_function)(char *, int);
+
 typedef struct {
     PyObject_HEAD
 
     PyObject *name;    /* the name of this type */
     PyObject *values;  /* the different types this instance can match */
 
-    dbapitypeobject_cast_function  ccast;  /* the C casting function */
-    PyObject                      *pcast;  /* the python casting function */
+    dbapitypeobject_cast_function     ccast;  /* the C casting function */
+    dbapitypeobject_rawcast_function  rcast;  /* the C raw casting function */
+    PyObject                         *pcast;  /* the python casting function */
 } psyco_DBAPITypeObject;
 
+
+/**** casting functions resolved once per result by the cursor ****/
+
+/* the memo of a date/time column: DATEMEMO entries (a power of 2) holding
+   values up to DATEMEMOKEY characters long */
+#define DATEMEMO 16
+#define DATEMEMOKEY 48
+
+typedef struct {
+    int       len;
+    char      key[DATEMEMOKEY];  /* the value returned by libpq */
+    PyObject *value;             /* the object built from it or NULL */
+} psyco_CastMemo;
+
+typedef struct {
+    dbapitypeobject_rawcast_function  rcast;  /* raw cast, NULL if missing */
+    dbapitypeobject_cast_function     ccast;  /* C cast, NULL if missing */
+    PyObject                         *cast;   /* the type object (borrowed) */
+    psyco_CastMemo                   *memo;   /* DATEMEMO entries or NULL */
+} psyco_CastInfo;
+
 /* the object type */
 extern PyTypeObject psyco_DBAPITypeObject_Type;
 
@@ -72,6 +99,12 @@ typedef struct {
 extern int psyco_init_types(PyObject *md);
 extern int psyco_add_type(PyObject *obj);
 
+/* fill a psyco_CastInfo from a type object, free an array of them and
+   convert a value through the memo of a date/time column */
+extern void psyco_get_castinfo(PyObject *obj, psyco_CastInfo *info, int memo);
+extern void psyco_free_castinfo(psyco_CastInfo *info, int n);
+extern PyObject *psyco_memo_rawcast(psyco_CastInfo *info, char *s, int len);
+
 /* the C callable DBAPITypeObject creator function */
 PyObject *new_psyco_typeobject(psyco_DBAPIInitList *type);
 